@@ -53,20 +53,27 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   tlb_setpid: set the address space ID that TLB lookups match
+ *        entries against. As the ID lives in the ENTRYHI register,
+ *        every other function here changes it too: reset it when done.
  */
 
 void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setpid(uint32_t pid);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * Note that the MIPS has support for a 6-bit address space ID. dumbvm
+ * doesn't use it and leaves TLBHI_PID always zero; the paging VM tags
+ * user translations with it (see kern/vm/vm.c). TLBLO_GLOBAL, which
+ * makes an entry match whatever the current ASID, is only set on the
+ * translations of kernel pages in kseg2 (see kern/vm/kvmap.c). The
+ * bits that aren't assigned a meaning are left zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,14 +85,15 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
 #define TLBLO_NOCACHE 0x00000800
 #define TLBLO_DIRTY   0x00000400
 #define TLBLO_VALID   0x00000200
-/*      TLBLO_GLOBAL  0x00000100 */
+#define TLBLO_GLOBAL  0x00000100
 
 /*
  * Values for completely invalid TLB entries. The TLB entry index should
@@ -101,5 +109,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of address space IDs.
+ */
+
+#define NUM_ASID 64
+
 
 #endif /* _MIPS_TLB_H_ */
@@ -117,10 +117,8 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	uint32_t ts_asid;		/* ASID of the page on the target */
+	vaddr_t ts_vaddr;		/* page to invalidate */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
 #include <current.h>
 #include <addrspace.h>
@@ -178,6 +179,32 @@ syscall(struct trapframe *tf)
     case SYS_execv:
       retval = sys_execv((const char *)tf->tf_a0, (char **)tf->tf_a1, &err);
       break;
+    case SYS_sbrk:
+      retval = (int32_t)sys_sbrk((intptr_t)tf->tf_a0, &err);
+      break;
+    case SYS_mmap:
+      /* fd is at sp+16, the 64-bit offset aligned at sp+24 */
+      err = copyin((const_userptr_t)(tf->tf_sp + 16), &val3, sizeof(val3));
+      if (err == 0) {
+        err = copyin((const_userptr_t)(tf->tf_sp + 24), &val_64,
+          sizeof(val_64));
+      }
+      if (err == 0) {
+        retval = (int32_t)sys_mmap((userptr_t)tf->tf_a0,
+          (size_t)tf->tf_a1, (int)tf->tf_a2, (int)tf->tf_a3,
+          (int)val3, val_64, &err);
+      }
+      break;
+    case SYS_munmap:
+      retval = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, &err);
+      break;
+    case SYS_msync:
+      retval = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+        (int)tf->tf_a2, &err);
+      break;
+    case SYS_vmstat:
+      retval = sys_vmstat((userptr_t)tf->tf_a0, (int)tf->tf_a1, &err);
+      break;
 #endif
     default:
       kprintf("Unknown syscall %d\n", callno);
@@ -38,6 +38,8 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <vmstats.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -64,43 +66,11 @@
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
-static struct spinlock freemem_lock = SPINLOCK_INITIALIZER;
-
-static unsigned char *freeRamFrames = NULL;
-static unsigned long *allocSize = NULL;
-static int nRamFrames = 0;
-
-static int allocTableActive = 0;
-
-static int isTableActive()
-{
-  int active;
-  spinlock_acquire(&freemem_lock);
-  active = allocTableActive;
-  spinlock_release(&freemem_lock);
-  return active;
-}
-
 void
 vm_bootstrap(void)
 {
-  int i;
-  nRamFrames = ((int)ram_getsize()) / PAGE_SIZE;
-  /* alloc freeRamFrame and allocSize */
-  freeRamFrames = kmalloc(sizeof(unsigned char) * nRamFrames);
-  if (freeRamFrames == NULL) return;
-  allocSize = kmalloc(sizeof(unsigned long) * nRamFrames);
-  if (allocSize == NULL) {
-    /* reset to disable this vm management */
-    freeRamFrames = NULL; return;
-  }
-  for (i = 0; i < nRamFrames; i++) {
-    freeRamFrames[i] = (unsigned char)0;
-    allocSize[i] = 0;
-  }
-  spinlock_acquire(&freemem_lock);
-  allocTableActive = 1;
-  spinlock_release(&freemem_lock);
+  /* Hand physical memory over to the buddy allocator */
+  coremap_bootstrap();
 }
 
 /*
@@ -122,79 +92,30 @@ dumbvm_can_sleep(void)
   }
 }
 
-static paddr_t
-getfreeppages(unsigned long npages)
-{
-  paddr_t addr;
-  long i, first, found, np = (long)npages;
-
-  if (!isTableActive()) return 0;
-  spinlock_acquire(&freemem_lock);
-  for (i = 0, first = found = -1; i < nRamFrames; i++) {
-    if (freeRamFrames[i]) {
-      if (i == 0 || !freeRamFrames[i - 1])
-        first = i; /* set first free in an interval */
-      if (i - first + 1 >= np) {
-        found = first;
-        break;
-      }
-    }
-  }
-
-  if (found >= 0) {
-    for (i = found; i < found + np; i++) {
-      freeRamFrames[i] = (unsigned char)0;
-    }
-    allocSize[found] = np;
-    addr = (paddr_t)found * PAGE_SIZE;
-  } else {
-    addr = 0;
-  }
-
-  spinlock_release(&freemem_lock);
-
-  return addr;
-}
-
 static paddr_t
 getppages(unsigned long npages)
 {
   paddr_t addr;
 
-  /* try freed pages first */
-  addr = getfreeppages(npages);
-  if (addr == 0) {
-    /* call stealmem */
+  if (coremap_isactive()) {
+    addr = coremap_alloc(npages);
+  } else {
+    /* too early in boot: call stealmem */
     spinlock_acquire(&stealmem_lock);
     addr = ram_stealmem(npages);
     spinlock_release(&stealmem_lock);
-  }
-  if (addr != 0 && isTableActive()) {
-    spinlock_acquire(&freemem_lock);
-    allocSize[addr / PAGE_SIZE] = npages;
-    spinlock_release(&freemem_lock);
+    vmstats_inc(VMS_STEALMEM);
   }
 
+  vmstats_inc(addr != 0 ? VMS_FRAME_ALLOCS : VMS_FRAME_FAILS);
   return addr;
 }
 
-static int
-freeppages(paddr_t addr, unsigned long npages)
+static void
+freeppages(paddr_t addr)
 {
-  long i, first, np = (long)npages;
-
-  if (!isTableActive()) return 0;
-  first = addr / PAGE_SIZE;
-  KASSERT(allocSize != NULL);
-  KASSERT(nRamFrames > first);
-
-  spinlock_acquire(&freemem_lock);
-  for (i = first; i < first + np; i++) {
-    freeRamFrames[i] = (unsigned char)1;
-  }
-  spinlock_release(&freemem_lock);
-
-  return 1;
+  /* Frames stolen before vm_bootstrap are ignored by the coremap */
+  coremap_free(addr);
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -211,16 +132,17 @@ alloc_kpages(unsigned npages)
   return PADDR_TO_KVADDR(pa);
 }
 
+/* No kseg2 mappings here: only physically contiguous pages */
+vaddr_t
+alloc_kvpages(unsigned npages)
+{
+  return alloc_kpages(npages);
+}
+
 void
 free_kpages(vaddr_t addr)
 {
-  if (isTableActive()) {
-    paddr_t paddr = addr - MIPS_KSEG0;
-    long first = paddr / PAGE_SIZE;
-    KASSERT(allocSize != NULL);
-    KASSERT(nRamFrames > first);
-    freeppages(paddr, allocSize[first]);
-  }
+  freeppages(addr - MIPS_KSEG0);
 }
 
 void
@@ -230,6 +152,12 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
   panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+void
+vm_tlbshootdown_all(void)
+{
+  panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -250,6 +178,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
       panic("dumbvm: got VM_FAULT_READONLY\n");
     case VM_FAULT_READ:
     case VM_FAULT_WRITE:
+      vmstats_inc(VMS_TLB_FAULTS);
       break;
     default:
       return EINVAL;
@@ -320,12 +249,18 @@ vm_fault(int faulttype, vaddr_t faultaddress)
     DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
     tlb_write(ehi, elo, i);
     splx(spl);
+    vmstats_inc(VMS_TLB_FREE);
     return 0;
   }
 
-  kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+  /* TLB full: evict a random entry, it can be refilled on demand */
+  ehi = faultaddress;
+  elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+  DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x (evict)\n", faultaddress, paddr);
+  tlb_random(ehi, elo);
   splx(spl);
-  return EFAULT;
+  vmstats_inc(VMS_TLB_EVICTS);
+  return 0;
 }
 
 struct addrspace *
@@ -350,9 +285,9 @@ as_create(void)
 void as_destroy(struct addrspace *as)
 {
   dumbvm_can_sleep();
-  freeppages(as->as_pbase1, as->as_npages1);
-  freeppages(as->as_pbase2, as->as_npages2);
-  freeppages(as->as_stackpbase, DUMBVM_STACKPAGES);
+  freeppages(as->as_pbase1);
+  freeppages(as->as_pbase2);
+  freeppages(as->as_stackpbase);
   kfree(as);
 }
 
@@ -375,6 +310,8 @@ as_activate(void)
   }
 
   splx(spl);
+
+  vmstats_inc(VMS_TLB_FLUSHES);
 }
 
 void
@@ -428,7 +365,12 @@ static
 void
 as_zero_region(paddr_t paddr, unsigned npages)
 {
+  unsigned i;
+
   bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+  for (i = 0; i < npages; i++) {
+    vmstats_inc(VMS_ZERO_FILLS);
+  }
 }
 
 int
@@ -521,47 +463,3 @@ as_copy(struct addrspace *old, struct addrspace **ret)
   *ret = new;
   return 0;
 }
-
-#if OPT_SHELL
-bool
-as_check_addr(struct addrspace *as, vaddr_t vaddr)
-{
-  vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-
-  /* Assert that the address space has been set up properly. */
-  KASSERT(as != NULL);
-  KASSERT(as->as_vbase1 != 0);
-  KASSERT(as->as_pbase1 != 0);
-  KASSERT(as->as_npages1 != 0);
-  KASSERT(as->as_vbase2 != 0);
-  KASSERT(as->as_pbase2 != 0);
-  KASSERT(as->as_npages2 != 0);
-  KASSERT(as->as_stackpbase != 0);
-  KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-  KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-  KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-  KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
-  KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-
-  vbase1 = as->as_vbase1;
-  vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-  vbase2 = as->as_vbase2;
-  vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-  stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-  stacktop = USERSTACK;
-
-  if ((vaddr >= vbase1) && (vaddr < vtop1)) {
-    return true;
-  }
-
-  if ((vaddr >= vbase2) && (vaddr < vtop2)) {
-    return true;
-  }
-
-  if ((vaddr >= stackbase) && (vaddr < stacktop)) {
-    return true;
-  }
-
-  return false;
-}
-#endif
@@ -232,14 +232,17 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(), to check that the file can be mapped. The VM
+ * system faults pages in with VOP_READ and writes them back with
+ * VOP_WRITE, which is all it needs from SFS; directories are
+ * refused by sfs_dirops.
  */
 static
 int
 sfs_mmap(struct vnode *v   /* add stuff as needed */)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
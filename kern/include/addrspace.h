@@ -36,11 +36,64 @@
 
 
 #include <vm.h>
+#include <pagetable.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
+#include "opt-shell.h"
 
 struct vnode;
+struct lock;
 
 
+#if !OPT_DUMBVM
+/* Region permissions, as in the ELF program header p_flags */
+#define RG_R 0x4
+#define RG_W 0x2
+#define RG_X 0x1
+/* Shared file mapping: written pages go back to the file */
+#define RG_SHARED 0x8
+/* Segment of an executable (as_define_file): may use the page cache */
+#define RG_TEXT 0x10
+
+/*
+ * Region - a page-aligned range of the address space with the same
+ * permissions. The pages themselves are tracked in the page table of
+ * the address space, and only get a frame when first touched.
+ *
+ * A region loaded from an executable, or a file mapping made with
+ * mmap, also records where its contents are in the file: the first
+ * touch of a page reads it from there (bytes past rg_filesz are
+ * zero-filled).
+ */
+struct region {
+        vaddr_t rg_vbase;               /* first virtual address */
+        size_t rg_npages;               /* number of pages (0 if unused) */
+        int rg_flags;                   /* RG_* */
+        struct vnode *rg_vnode;         /* backing file, or NULL */
+        off_t rg_foffset;               /* file offset of rg_fvaddr */
+        vaddr_t rg_fvaddr;              /* where the file contents start */
+        size_t rg_filesz;               /* size of the file contents */
+};
+
+/* Max number of ELF segments in an address space */
+#define AS_MAXSEGS 4
+
+/*
+ * The user stack starts with VM_STACKPAGES pages and grows down when
+ * a page below it is touched, up to VM_STACKMAX pages. VM_STACKGUARD
+ * pages are always left unmapped between the heap and the stack, so
+ * that neither can run into the other.
+ */
+#define VM_STACKPAGES 2
+#define VM_STACKMAX   1024
+#define VM_STACKGUARD 16
+
+/* Max number of mmap mappings in an address space */
+#define AS_MAXMAPS 16
+/* mmap places mappings top-down from here, below the stack's room */
+#define VM_MMAPTOP (USERSTACK - (VM_STACKMAX + VM_STACKGUARD) * PAGE_SIZE)
+#endif
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
@@ -58,7 +111,16 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct region as_segs[AS_MAXSEGS]; /* ELF segments */
+        unsigned as_nsegs;              /* number of ELF segments */
+        struct region as_stack;         /* user stack */
+        struct region as_heap;          /* heap, after the ELF segments */
+        vaddr_t as_heaptop;             /* current break (end of heap) */
+        struct region as_maps[AS_MAXMAPS]; /* mmap mappings (unused: 0 pages) */
+        bool as_loading;                /* true between prepare and complete load */
+        struct pagetable *as_pt;        /* page table */
+        struct lock *as_lock;           /* protects changes to as_pt */
+        uint32_t as_asid[MAXCPUS];      /* TLB address space ID, per cpu */
 #endif
 };
 
@@ -73,7 +135,8 @@ struct addrspace {
  *    as_copy   - create a new address space that is an exact copy of
  *                an old one. Probably calls as_create to get a new
  *                empty address space and fill it in, but that's up to
- *                you.
+ *                you. (Outside dumbvm, pages are shared copy-on-write
+ *                rather than copied.)
  *
  *    as_activate - make curproc's address space the one currently
  *                "seen" by the processor.
@@ -95,10 +158,32 @@ struct addrspace {
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
+ *    as_define_file - record that the region starting at VADDR is to be
+ *                filled with FILESIZE bytes read from offset OFFSET
+ *                of file V (not with dumbvm). Pages are read when
+ *                first touched.
+ *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes and hand
+ *                back the old end (not with dumbvm). The heap starts
+ *                empty right after the ELF segments; pages are
+ *                allocated when touched, and freed when the heap
+ *                shrinks below them.
+ *
+ *    as_mmap   - add a mapping of LEN bytes with region flags FLAGS,
+ *                backed by FILESZ bytes of file V from OFFSET (or
+ *                zero-filled if V is NULL), and hand back its address
+ *                (not with dumbvm).
+ *
+ *    as_munmap - remove the mapping at VADDR, which must be LEN bytes
+ *                long, writing back its modified pages if shared.
+ *
+ *    as_msync  - write back the modified pages of shared mappings in
+ *                the LEN bytes from VADDR.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -114,12 +199,47 @@ int               as_define_region(struct addrspace *as,
                                    int readable,
                                    int writeable,
                                    int executable);
+#if !OPT_DUMBVM
+int               as_define_file(struct addrspace *as, struct vnode *v,
+                                 off_t offset, vaddr_t vaddr,
+                                 size_t memsize, size_t filesize);
+#endif
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, size_t len, int flags,
+                          struct vnode *v, off_t offset, size_t filesz,
+                          vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr, size_t len);
+#endif
 
-#if OPT_DUMBVM && OPT_SHELL
-bool              as_check_addr(struct addrspace *as, vaddr_t vaddr);
+#if !OPT_DUMBVM
+/*
+ * Functions in addrspace.c used by the fault handler:
+ *
+ *    as_find_region - return the region containing VADDR, or NULL.
+ *
+ *    as_grow_stack - grow the stack down to VADDR if that's allowed, and
+ *                return the stack region; else return NULL.
+ *
+ *    as_region_writeable - check if pages of a region can currently be
+ *                mapped writeable (segments are writeable while the
+ *                executable is being loaded).
+ *
+ *    as_fault_page - get the page at VADDR ready to be mapped and
+ *                return its page table entry: allocate and zero it on
+ *                first touch and, before a write, give the address
+ *                space a private copy of a copy-on-write page.
+ */
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+struct region    *as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+bool              as_region_writeable(struct addrspace *as, struct region *rg);
+int               as_fault_page(struct addrspace *as, struct region *rg,
+                                vaddr_t vaddr, bool write, pte_t *ret);
 #endif
 
 /*
@@ -64,6 +64,10 @@ void gettime(struct timespec *ret);
  *
  * add: ret = t1 + t2
  * sub: ret = t1 - t2
+ * elapsed_ms: milliseconds from t1 to t2
+ *
+ * rate_per_sec gives the rate of OPS events that took MS milliseconds,
+ * per second (0 if MS is 0), for benchmarks.
  */
 
 void timespec_add(const struct timespec *t1,
@@ -72,6 +76,9 @@ void timespec_add(const struct timespec *t1,
 void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
+unsigned long timespec_elapsed_ms(const struct timespec *t1,
+				  const struct timespec *t2);
+unsigned long rate_per_sec(unsigned long ops, unsigned long ms);
 
 /*
  * clocksleep() suspends execution for the requested number of seconds,
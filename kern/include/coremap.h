@@ -0,0 +1,70 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+#include <types.h>
+
+/*
+ * Physical page frame allocator (coremap).
+ *
+ * Frames from the first free physical page up to the end of RAM are
+ * managed with a binary buddy system: a free list per order, where a
+ * block of order k is 2^k contiguous frames aligned to its size.
+ * Allocation splits the smallest large-enough block, free coalesces
+ * a block with its buddy as long as the buddy is free too.
+ *
+ * Blocks larger than 2^COREMAP_MAXORDER frames are never formed, so
+ * that is also the largest contiguous allocation possible.
+ *
+ * Single-frame allocations and frees go through a per-cpu cache of
+ * free frames and normally don't touch the global lock.
+ *
+ * Single frames are reference counted so they can be shared (used by
+ * copy-on-write fork): coremap_alloc returns a frame with one
+ * reference, coremap_incref adds one and coremap_free drops one,
+ * freeing the frame when the last reference goes away.
+ *
+ * Frames of user pages owned by a single address space are recorded
+ * with their owner and can be picked for eviction by the pager.
+ *
+ * Idle cpus keep a small pool of zero-filled frames, so that
+ * coremap_alloc_zeroed usually doesn't have to clear a page itself.
+ */
+
+#define COREMAP_MAXORDER 10
+
+struct addrspace;
+
+/* Take over physical memory from ram.c. Call once from vm_bootstrap. */
+void    coremap_bootstrap(void);
+/* check if the coremap has been bootstrapped */
+bool    coremap_isactive(void);
+/* allocate npages contiguous frames; return 0 if not available */
+paddr_t coremap_alloc(unsigned long npages);
+/* allocate a zero-filled frame; return 0 if not available */
+paddr_t coremap_alloc_zeroed(void);
+/* called by idle cpus: zero a frame for the pool; true if one was */
+bool    coremap_idle_zero(void);
+/* free frames previously obtained from coremap_alloc */
+void    coremap_free(paddr_t paddr);
+/* add a reference to a single frame */
+void    coremap_incref(paddr_t paddr);
+/* return the number of references to a single frame */
+unsigned coremap_refcount(paddr_t paddr);
+/* record the user page a single frame backs; AS == NULL for none */
+void    coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+/* mark a frame as recently referenced */
+void    coremap_touch(paddr_t paddr);
+/* pick a user page to evict and mark it busy; return 0 if none */
+paddr_t coremap_victim(struct addrspace **as, vaddr_t *vaddr);
+/* clear the busy mark of a frame picked by coremap_victim */
+void    coremap_unbusy(paddr_t paddr);
+/* cheap, unlocked estimate of the number of free frames */
+unsigned long coremap_freeestimate(void);
+/* return cached frames from every cpu to the buddy lists */
+void    coremap_drain(void);
+/* return the current number of free frames */
+unsigned long coremap_freepages(void);
+/* print per-order free block counts */
+void    coremap_printstats(void);
+
+#endif /* _COREMAP_H_ */
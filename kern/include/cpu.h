@@ -35,6 +35,13 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+/* Number of scheduler priority levels */
+#define SCHED_NLEVELS 4
+/* Time slice at a level, in hardclocks */
+#define SCHED_QUANTUM(level) (1U << (level))
+/* Sleep this long, in hardclocks, to move up a level on wakeup */
+#define SCHED_BOOST_HARDCLOCKS 2
+
 
 /*
  * Per-cpu structure
@@ -59,16 +66,24 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Exited threads kept for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * The run queue has one list per priority level, 0 being the
+	 * highest; see the scheduler in thread.c.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues */
 	struct spinlock c_runqueue_lock;
+	unsigned long c_demotions;	/* Threads that used up a slice */
+	unsigned long c_boosts;		/* Threads boosted on wakeup */
+	unsigned long c_agings;		/* Threads raised for waiting long */
+	unsigned long c_steals;		/* Threads taken from other cpus */
 
 	/*
 	 * Accessed by other cpus.
@@ -82,10 +97,18 @@ struct cpu {
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
+	 *
+	 * If more requests come in than fit, they are dropped and
+	 * c_shootdownall is set: the whole TLB gets flushed instead.
+	 * Each batch of requests gets a sequence number; c_shootdown_done
+	 * is the last one handled, for senders waiting for theirs.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	bool c_shootdownall;		/* Flush the whole TLB instead */
+	uint32_t c_shootdown_seq;	/* Last batch queued */
+	uint32_t c_shootdown_done;	/* Last batch handled */
 	struct spinlock c_ipi_lock;
 
 	/*
@@ -102,12 +125,15 @@ struct cpu {
  *
  * cpu_create calls cpu_machdep_init.
  *
+ * cpu_count returns the number of CPUs created so far.
+ *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
  * cpu_hatch after having claimed the startup stack and thread created
  * for the cpu.
  */
 struct cpu *cpu_create(unsigned hardware_number);
+unsigned cpu_count(void);
 void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
@@ -154,7 +180,13 @@ void cpu_halt(void);
  *
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
- * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown is like ipi_send but carries a batch of N TLB
+ * shootdown requests (a full TLB flush if N > TLBSHOOTDOWN_MAX) in a
+ * single IPI. It returns the sequence number of the batch, which can
+ * be passed to ipi_tlbshootdown_wait to wait until it's been handled.
+ * Don't wait with interrupts off: the target may be waiting for us.
+ * ipi_tlbshootdown_allcpus carries out a batch on every CPU, this one
+ * included, and waits until they're all done.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -168,7 +200,11 @@ void cpu_halt(void);
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+uint32_t ipi_tlbshootdown(struct cpu *target,
+			  const struct tlbshootdown *mappings, unsigned n);
+void ipi_tlbshootdown_wait(struct cpu *target, uint32_t seq);
+void ipi_tlbshootdown_allcpus(const struct tlbshootdown *mappings,
+			      unsigned n);
 
 void interprocessor_interrupt(void);
 
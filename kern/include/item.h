@@ -17,6 +17,7 @@
 
 
 /* FCB operations */
+void FCB_bootstrap(void);
 CAitem newFCB(void);
 CAitem newFCB_filled(struct vnode *v, off_t offset, unsigned int countRef, int flag, struct lock *vn_lk);
 int cmpFCB(CAkey a , CAkey b);
@@ -0,0 +1,29 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap(), munmap() and msync(), shared between the
+ * kernel and <sys/mman.h> in userland.
+ */
+
+/* Page protections (prot argument to mmap) */
+#define PROT_NONE     0x0
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+
+/* Mapping flags (flags argument to mmap); one of SHARED or PRIVATE */
+#define MAP_SHARED    0x1       /* writes go back to the file */
+#define MAP_PRIVATE   0x2       /* writes stay in this process */
+#define MAP_ANON      0x1000    /* zero-filled memory, no file */
+#define MAP_ANONYMOUS MAP_ANON
+
+/* What mmap returns on error */
+#define MAP_FAILED    ((void *)-1)
+
+/* Flags for msync (pages are always written back synchronously) */
+#define MS_ASYNC      0x1
+#define MS_SYNC       0x2
+#define MS_INVALIDATE 0x4
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,84 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * VM event counters, shared between the kernel and <sys/vmstat.h> in
+ * userland. vmstat() fills in an array indexed by these.
+ */
+
+/* TLB misses handled by vm_fault */
+#define VMS_TLB_FAULTS    0
+/* misses refilled straight from the page table */
+#define VMS_TLB_REFILLS   1
+/* translations loaded in an unused TLB slot */
+#define VMS_TLB_FREE      2
+/* translations loaded by evicting a valid TLB entry */
+#define VMS_TLB_EVICTS    3
+/* writes to pages mapped read-only */
+#define VMS_TLB_READONLY  4
+/* whole TLB invalidations */
+#define VMS_TLB_FLUSHES   5
+/* address space IDs handed out */
+#define VMS_ASID_ASSIGNS  6
+/* translations invalidated on all cpus */
+#define VMS_TLB_SHOOTDOWNS 7
+/* pages read from swap */
+#define VMS_SWAP_IN       8
+/* pages written to swap */
+#define VMS_SWAP_OUT      9
+/* pages evicted by a fault that found no free frame */
+#define VMS_SWAP_DIRECT   10
+/* eviction candidates skipped as their owner was busy */
+#define VMS_SWAP_SKIPPED  11
+/* pages read from executables and mapped files */
+#define VMS_FILE_READS    12
+/* faults that grew a user stack */
+#define VMS_STACK_GROWS   13
+/* pages of shared mappings written back to their file */
+#define VMS_FILE_WRITES   14
+/* shootdown IPIs sent (one per target cpu per batch) */
+#define VMS_TLB_IPIS      15
+/* pages zero-filled on first touch */
+#define VMS_ZERO_FILLS    16
+/* successful frame allocations (kernel pages and user frames) */
+#define VMS_FRAME_ALLOCS  17
+/* frame allocations that found no memory */
+#define VMS_FRAME_FAILS   18
+/* page allocations served by ram_stealmem before the coremap was up */
+#define VMS_STEALMEM      19
+/* large kernel allocations mapped in kseg2 */
+#define VMS_KVMAP_ALLOCS  20
+/* TLB misses on kseg2 */
+#define VMS_KVMAP_FAULTS  21
+/* TLB flushes on all cpus to reuse freed kseg2 pages */
+#define VMS_KVMAP_PURGES  22
+#define VMS_NSTATS        23
+
+/* Descriptions of the counters, in order */
+#define VMS_NAMES { \
+  "TLB faults", \
+  "TLB refills from page table", \
+  "TLB loads into free slots", \
+  "TLB evictions", \
+  "TLB read-only faults", \
+  "TLB flushes", \
+  "ASIDs assigned", \
+  "TLB shootdowns", \
+  "Pages swapped in", \
+  "Pages swapped out", \
+  "Evictions in the fault path", \
+  "Eviction candidates skipped", \
+  "Pages read from files", \
+  "Stack growth faults", \
+  "Pages written back to files", \
+  "TLB shootdown IPIs", \
+  "Zero-filled pages", \
+  "Frame allocations", \
+  "Failed frame allocations", \
+  "ram_stealmem allocations", \
+  "Kernel allocations mapped in kseg2", \
+  "kseg2 TLB faults", \
+  "kseg2 TLB purges", \
+}
+
+#endif /* _KERN_VMSTAT_H_ */
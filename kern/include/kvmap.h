@@ -0,0 +1,38 @@
+#ifndef _KVMAP_H_
+#define _KVMAP_H_
+
+#include <types.h>
+#include <vm.h>
+
+/*
+ * Virtually contiguous kernel allocations (not with dumbvm).
+ *
+ * Multi-page kernel allocations normally come from the coremap as
+ * physically contiguous frames, which kseg0 maps for free. When
+ * physical memory is too fragmented for that, the frames are taken
+ * one at a time wherever they are and mapped at consecutive pages of
+ * a range of kseg2, which is translated by the TLB. vm_fault loads
+ * the translations, as global entries, from a flat table of the
+ * range.
+ *
+ * Freeing a range doesn't shoot down its translations right away.
+ * Its pages are only reused after every cpu's TLB has been flushed,
+ * which is done once for all the ranges freed since the last time,
+ * when kvmap_alloc finds no other room.
+ */
+
+/* The kseg2 range used */
+#define KVMAP_BASE   MIPS_KSEG2
+#define KVMAP_NPAGES 4096
+#define KVMAP_TOP    (KVMAP_BASE + KVMAP_NPAGES * PAGE_SIZE)
+
+/* set up the table; call from vm_bootstrap after the coremap */
+void    kvmap_bootstrap(void);
+/* map NPAGES frames at a free range; return 0 if out of memory or room */
+vaddr_t kvmap_alloc(unsigned npages);
+/* unmap a range returned by kvmap_alloc and free its frames */
+void    kvmap_free(vaddr_t vaddr);
+/* return the frame VADDR is mapped to, or 0 if none; doesn't sleep */
+paddr_t kvmap_translate(vaddr_t vaddr);
+
+#endif /* _KVMAP_H_ */
@@ -124,7 +124,10 @@ uint32_t random(void);
  * If out of memory, kmalloc returns NULL.
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
- * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * labeling (for leak detection) in kmalloc.c (q.v.) is enabled, and
+ * kheap_profile, which prints the top allocation sites, does nothing
+ * unless allocation-site profiling there is. kmalloc_drain releases
+ * memory kmalloc keeps cached, for when memory runs low.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +135,8 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_profile(void);
+void kmalloc_drain(void);
 
 /*
  * C string functions.
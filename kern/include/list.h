@@ -10,6 +10,8 @@
 
 typedef struct list_s *list;    /* Opaque pointer */
 
+/* set up the list node cache; call once at boot before using lists */
+void    list_bootstrap(void);
 /* create list */
 list    list_create(void);
 /* check if the list is empty */
@@ -0,0 +1,58 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+#include <types.h>
+
+/*
+ * Page cache of read-only executable pages (not with dumbvm).
+ *
+ * Pages of read-only segments (program text) are read from the
+ * executable once and the frame is then shared by every address space
+ * running the same binary. Cached frames are looked up by vnode and
+ * file offset; LEN is how much of the page comes from the file (the
+ * rest is zero) so a partial last page can't be confused with a full
+ * page at the same offset.
+ *
+ * Each entry also records the vn_id and vn_version of the vnode when
+ * the page was read. Writing or truncating the file changes
+ * vn_version, so a lookup never returns a page of an older version of
+ * the file; such stale pages are dropped when found. The cache holds
+ * no reference to the vnode, which can go away when the file is
+ * removed; vn_id tells a later vnode at the same address from it.
+ *
+ * The cache holds a reference to each of its frames; every page table
+ * mapping one holds another. A frame only the cache references is no
+ * longer mapped anywhere and can be dropped when memory runs low.
+ */
+
+/* Number of hash buckets */
+#define PC_NBUCKETS 64
+
+struct vnode;
+
+/* set up the cache; call from vm_bootstrap */
+void    pagecache_bootstrap(void);
+/*
+ * Return the cached frame for (V, OFFSET, LEN) with a reference added
+ * for the caller, or 0 if it isn't cached.
+ */
+paddr_t pagecache_lookup(struct vnode *v, off_t offset, size_t len);
+/*
+ * Offer PADDR, a frame just filled with (V, OFFSET, LEN) that the
+ * caller holds a reference to, to the cache. VERSION is what
+ * vnode_getversion returned before the page was read. Returns the
+ * frame the caller should map, with the caller's reference: PADDR
+ * itself, or the frame cached by someone else in the meantime (PADDR
+ * is then freed). If the cache can't take the frame, or the file
+ * changed since VERSION, PADDR stays private; *SHARED tells which.
+ */
+paddr_t pagecache_insert(struct vnode *v, unsigned version, off_t offset,
+                         size_t len, paddr_t paddr, bool *shared);
+/* drop the pages of V that are older than its current contents */
+void    pagecache_invalidate(struct vnode *v);
+/* free up to NPAGES cached frames that are not mapped; returns how many */
+unsigned pagecache_reclaim(unsigned npages);
+/* print hit rate and size */
+void    pagecache_printstats(void);
+
+#endif /* _PAGECACHE_H_ */
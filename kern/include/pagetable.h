@@ -0,0 +1,61 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+#include <types.h>
+
+/*
+ * Two-level page table of an address space.
+ *
+ * The top 10 bits of a virtual address index the directory, the next
+ * 10 bits index a second-level table of PT_ENTRIES page table entries.
+ * Second-level tables are only allocated for the 4M chunks of the
+ * address space that have been touched, so a process pays for the
+ * pages it uses rather than for the layout of its address space, and
+ * a TLB refill is two array lookups.
+ *
+ * A page table entry holds the physical frame of a resident page in
+ * its top bits, plus the flags below. For a page that was paged out,
+ * the top bits hold its swap slot instead.
+ *
+ * Pages of shared file mappings are mapped read-only until written,
+ * so that PTE_DIRTY tells which ones must be written back.
+ */
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME  0xfffff000   /* physical frame */
+#define PTE_VALID  0x00000001   /* a frame backs the page */
+#define PTE_WRITE  0x00000002   /* the page may be written */
+#define PTE_COW    0x00000004   /* the frame is shared copy-on-write */
+#define PTE_SWAPPED 0x00000008  /* the page is in a swap slot */
+#define PTE_DIRTY  0x00000010   /* written since last written to its file */
+
+#define PTE_SLOT(pte)    ((pte) >> 12)
+#define PTE_MKSWAP(slot) (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+#define PT_ENTRIES 1024
+#define PT_DIRINDEX(va) (((va) >> 22) & (PT_ENTRIES - 1))
+#define PT_TABINDEX(va) (((va) >> 12) & (PT_ENTRIES - 1))
+
+struct pagetable {
+  pte_t *pt_dir[PT_ENTRIES];    /* second-level tables, or NULL */
+};
+
+/* create an empty page table; return NULL if out of memory */
+struct pagetable *pt_create(void);
+/* free a page table along with every frame and swap slot it references */
+void    pt_destroy(struct pagetable *pt);
+/*
+ * Return the entry for VADDR. If its second-level table doesn't exist,
+ * create it if CREATE is true (returning NULL if out of memory), else
+ * return NULL.
+ */
+pte_t  *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+/*
+ * Make NEW reference the same frames as OLD, marking the pages of both
+ * copy-on-write; pages in swap are copied to new slots. Returns an
+ * error code on error.
+ */
+int     pt_copy(struct pagetable *old, struct pagetable *new);
+
+#endif /* _PAGETABLE_H_ */
@@ -116,6 +116,8 @@ struct addrspace *proc_setas(struct addrspace *);
 #if OPT_SHELL
 /* Search for a process by pid in the Process Table */
 int proc_table_search(pid_t pid, struct proc **retproc);
+/* Wait for process termination and return exit status, without destroying the process */
+int proc_waitexit(struct proc *proc);
 /* Wait for process termination, destroy the process, and return exit status */
 int proc_wait(struct proc *proc);
 /* Signal for process termination */
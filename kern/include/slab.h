@@ -0,0 +1,37 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <types.h>
+
+/*
+ * Object caches for kernel objects of a fixed size that are allocated
+ * and freed all the time (processes, threads, open files, ...).
+ *
+ * A cache carves whole pages from the page allocator (slabs) into
+ * objects of its size, and hands freed objects out again without
+ * going through kmalloc. CTOR, if given, is run on each object when
+ * its slab is created and DTOR when the slab is given back, so an
+ * object must be freed in the state CTOR leaves it in; either may be
+ * NULL.
+ *
+ * Each cache keeps a few empty slabs around; more than that go back
+ * to the page allocator. Objects must be smaller than a page (well,
+ * than what fits in a slab with its header).
+ */
+
+struct kmem_cache;
+
+/* create a cache; returns NULL if out of memory */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     void (*ctor)(void *),
+                                     void (*dtor)(void *));
+/* destroy a cache; all its objects must have been freed */
+void    kmem_cache_destroy(struct kmem_cache *kc);
+/* get an object; returns NULL if out of memory */
+void   *kmem_cache_alloc(struct kmem_cache *kc);
+/* give back an object gotten from KC */
+void    kmem_cache_free(struct kmem_cache *kc, void *obj);
+/* print usage of every cache */
+void    kmem_cache_printstats(void);
+
+#endif /* _SLAB_H_ */
@@ -78,6 +78,8 @@ struct spinlock {
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
+ * tryacquire	Get the lock only if it is free; return whether we did.
+ *		Disables interrupts if it succeeds.
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
@@ -87,6 +89,7 @@ void spinlock_init(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
+bool spinlock_tryacquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
@@ -0,0 +1,43 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include <types.h>
+
+/*
+ * Swap: paging user memory out to a disk (not with dumbvm).
+ *
+ * The swap device is attached with vfs_swapon at boot; if it is
+ * missing the system runs without swap and simply runs out of memory
+ * as before. The device is divided in page-sized slots, tracked with
+ * a bitmap. When free memory runs low a pageout thread evicts user
+ * pages (picked by the coremap clock) to swap slots, so that page
+ * faults normally find a free frame; a fault that still finds none
+ * evicts a page itself.
+ */
+
+/* Device to swap to */
+#define SWAP_DEVICE "lhd0:"
+
+/* The pageout thread is woken below SWAP_FREELOW free frames... */
+#define SWAP_FREELOW  16
+/* ...and works until there are SWAP_FREEHIGH */
+#define SWAP_FREEHIGH 32
+
+struct addrspace;
+
+/* attach the swap device and start the pageout thread */
+void    swap_bootstrap(void);
+/*
+ * Allocate a frame for a user page of AS (whose as_lock is held),
+ * zero-filled if ZERO is set, evicting a page if needed. Returns 0 if
+ * no memory is available.
+ */
+paddr_t swap_getframe(struct addrspace *as, bool zero);
+/* read the page in SLOT into the frame PADDR and release the slot */
+int     swap_pagein(unsigned slot, paddr_t paddr);
+/* copy the page in SLOT to a new slot, returned in RET */
+int     swap_dup(unsigned slot, unsigned *ret);
+/* release a slot */
+void    swap_release(unsigned slot);
+
+#endif /* _SWAP_H_ */
@@ -84,6 +84,8 @@ struct lock {
 	struct wchan *lk_wchan;
 	struct spinlock lk_lock;
         volatile struct thread *lk_owner;
+	unsigned long lk_spins;		/* acquired by spinning */
+	unsigned long lk_sleeps;	/* waits that went to sleep */
 #endif
 };
 
@@ -93,9 +95,12 @@ void lock_destroy(struct lock *);
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. While the holder is running on another
+ *                   cpu, spin for a while instead of going to sleep.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
+ *    lock_tryacquire - Get the lock if nobody holds it, without waiting.
+ *                   Return true if the lock was acquired.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
@@ -103,6 +108,7 @@ void lock_destroy(struct lock *);
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
+bool lock_tryacquire(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
 
@@ -151,4 +157,48 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock, for data that is looked at much more often
+ * than it is changed.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * too, so a steady stream of readers can't keep writers out. This
+ * also means a reader must not take the lock again while it holds
+ * it, as a writer arriving in between would deadlock them both.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+	char *rwlk_name;
+	struct wchan *rwlk_rwchan;	/* readers wait here */
+	struct wchan *rwlk_wwchan;	/* writers wait here */
+	struct spinlock rwlk_lock;
+	unsigned rwlk_readers;		/* readers holding the lock */
+	unsigned rwlk_wwaiting;		/* writers waiting for it */
+	struct thread *rwlk_writer;	/* writer holding it, if any */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give back a read hold.
+ *    rwlock_acquire_write - Get the lock for writing: no other reader
+ *                           or writer holds it at the same time.
+ *    rwlock_release_write - Give back a write hold. Only the thread
+ *                           holding the lock for writing may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -76,6 +76,12 @@ pid_t sys_waitpid(pid_t pid, userptr_t statusp, int options, int *errp);
 pid_t sys_getpid(void);
 pid_t sys_fork(struct trapframe *ctf, int *errp);
 int sys_execv(const char *progname, char **args, int *errp);
+void *sys_sbrk(intptr_t amount, int *errp);
+void *sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+               off_t offset, int *errp);
+int sys_munmap(userptr_t addr, size_t len, int *errp);
+int sys_msync(userptr_t addr, size_t len, int flags, int *errp);
+int sys_vmstat(userptr_t counts, int n, int *errp);
 #endif
 
 #endif /* _SYSCALL_H_ */
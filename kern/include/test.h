@@ -54,10 +54,14 @@ int carraytest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
+int threadtest5(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int lockbench(int, char **);
+int rwlocktest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -97,6 +101,7 @@ int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int coremaptest(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
@@ -102,6 +102,16 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields. Changed by the thread's cpu while the
+	 * thread runs, under the run queue lock while it's queued,
+	 * and by whoever wakes it up while it sleeps.
+	 */
+	unsigned t_priority;		/* Level, 0 (highest) to SCHED_NLEVELS-1 */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	unsigned t_readysince;		/* c_hardclocks when queued */
+	unsigned t_sleepsince;		/* c_hardclocks when put to sleep */
+
 	/*
 	 * Public fields
 	 */
@@ -163,6 +173,18 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge a clock tick to the current thread, and yield if its time
+ * slice is up or a higher-priority thread is waiting. Called from the
+ * timer interrupt.
+ */
+void thread_tick(void);
+
+/*
+ * Print the length of each level of every cpu's run queue.
+ */
+void thread_printsched(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -55,8 +55,48 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Allocate kernel heap pages that only need to be virtually
+ * contiguous, so that large allocations don't fail just because
+ * physical memory is fragmented. Free them with free_kpages.
+ */
+vaddr_t alloc_kvpages(unsigned npages);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
+void vm_tlbshootdown_all(void);
+
+/*
+ * TLB context of address spaces (not with dumbvm):
+ *    vm_tlb_activate - make the TLB match the translations of AS on
+ *                the current cpu.
+ *    vm_tlb_invalidate - drop every translation of AS cached in the
+ *                TLB of any cpu.
+ *    vm_tlb_flushall - drop every translation from the TLB of every
+ *                cpu, and wait until done.
+ *    vm_tlb_shootdown - drop the translation of page VADDR of AS from
+ *                the TLB of every cpu, and wait until done.
+ *
+ * Pages whose translations must go can also be collected in a
+ * tlbbatch (vm_tlbbatch_init, then vm_tlbbatch_add for each page)
+ * and shot down together with vm_tlbbatch_flush, which sends at most
+ * one IPI to each cpu, and only to those running AS. A batch of more
+ * than TLBSHOOTDOWN_MAX pages flushes whole TLBs instead.
+ */
+struct addrspace;
+void vm_tlb_activate(struct addrspace *as);
+void vm_tlb_invalidate(struct addrspace *as);
+void vm_tlb_flushall(void);
+void vm_tlb_shootdown(struct addrspace *as, vaddr_t vaddr);
+
+struct tlbbatch {
+	struct addrspace *tb_as;
+	unsigned tb_count;			/* pages added */
+	vaddr_t tb_vaddr[TLBSHOOTDOWN_MAX];	/* the first ones */
+};
+void vm_tlbbatch_init(struct tlbbatch *tb, struct addrspace *as);
+void vm_tlbbatch_add(struct tlbbatch *tb, vaddr_t vaddr);
+void vm_tlbbatch_flush(struct tlbbatch *tb);
 
 
 #endif /* _VM_H_ */
@@ -0,0 +1,25 @@
+#ifndef _VMSTATS_H_
+#define _VMSTATS_H_
+
+/*
+ * VM event counters.
+ *
+ * Each cpu counts in its own slot, with interrupts off, so counting
+ * needs no lock and doesn't bounce cache lines between cpus. The
+ * slots are only summed up when the counters are printed, or read
+ * by a user program through the vmstat system call.
+ */
+
+#include <kern/vmstat.h>
+
+/* count one event of type STAT on the current cpu */
+void    vmstats_inc(unsigned stat);
+/* print the counters, summed over all cpus */
+void    vmstats_print(void);
+/*
+ * Store up to N counters, summed over all cpus, in COUNTS; return how
+ * many were stored.
+ */
+unsigned vmstats_get(unsigned long *counts, unsigned n);
+
+#endif /* _VMSTATS_H_ */
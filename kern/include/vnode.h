@@ -50,7 +50,10 @@ struct stat;
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	struct spinlock vn_countlock;   /* Lock for vn_refcount, vn_version */
+
+	unsigned vn_id;                 /* Unique among all vnodes ever */
+	unsigned vn_version;            /* Changed by each write/truncate */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -231,14 +234,14 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              vnode_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           vnode_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -266,6 +269,17 @@ void vnode_decref(struct vnode *);
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * Operations that change the contents of the file, and so change
+ * vn_version once done (handled above filesystem level). Caches of
+ * file contents (the page cache) tell from vn_version whether what
+ * they hold is still current, and from vn_id that a vnode isn't a
+ * new one allocated where an old one was.
+ */
+int vnode_write(struct vnode *, struct uio *);
+int vnode_truncate(struct vnode *, off_t);
+unsigned vnode_getversion(struct vnode *);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
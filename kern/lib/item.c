@@ -1,30 +1,42 @@
 #include "item.h"
+#include <slab.h>
+
+/* FCBs are opened and closed all the time: keep them in a cache */
+static struct kmem_cache *fcb_cache;
+
+void FCB_bootstrap(void)
+{
+    fcb_cache=kmem_cache_create("fcb", sizeof(struct _file), NULL, NULL);
+    if(fcb_cache==NULL)
+        panic("FCB_bootstrap: cannot create the fcb cache\n");
+}
 
 CAitem newFCB(void)
 {
-    fcb new=kmalloc(sizeof(*new));
+    fcb new=kmem_cache_alloc(fcb_cache);
+
+    if(new==NULL)
+        return NULL;
     bzero(new, sizeof(*new));
-    new->vn=kmalloc(sizeof(*new->vn));
 
-    return new==NULL? NULL:new;
+    return new;
 }
 
 CAitem newFCB_filled(struct vnode *v, off_t offset, unsigned int countRef, int flag, struct lock *vn_lk)
 {
-    struct stat *st=kmalloc(sizeof(struct stat));
-    fcb new=kmalloc(sizeof(*new));
-    bzero(new, sizeof(*new));
+    struct stat st;
+    fcb new=newFCB();
 
     if(new==NULL)
         return NULL;
 
 
-    VOP_STAT(v, st);
+    VOP_STAT(v, &st);
     new->vn=v;
     new->offset=offset;
     new->vn_lk=vn_lk;
     new->countRef=countRef;
-    new->size=st->st_size;
+    new->size=st.st_size;
     new->flag=flag;
 
     return new;
@@ -45,7 +57,7 @@ void freeFCB(CAitem a)
 
     vfs_close(source->vn);
     lock_destroy((source->vn_lk));
-    kfree(source);
+    kmem_cache_free(fcb_cache, source);
     source=NULL;
 }
 
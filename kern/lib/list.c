@@ -2,6 +2,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <list.h>
+#include <slab.h>
 
 typedef struct node_s node_t;
 
@@ -17,11 +18,14 @@ struct list_s {
     size_t cnt;
 };
 
+/* Nodes come and go with every insertion and deletion */
+static struct kmem_cache *node_cache;
+
 ////////////////////////////////////////////////////////////
 // internal functions
 
 static node_t *newNode(void *data, node_t *next, node_t *prev) {
-    node_t *n = kmalloc(sizeof(*n));
+    node_t *n = kmem_cache_alloc(node_cache);
     if (n == NULL) {
         return NULL;
     }
@@ -50,6 +54,13 @@ static int cmpKeys(const void *av, const void *bv, size_t len) {
 ////////////////////////////////////////////////////////////
 // external interface
 
+void list_bootstrap(void) {
+    node_cache = kmem_cache_create("list node", sizeof(node_t), NULL, NULL);
+    if (node_cache == NULL) {
+        panic("list_bootstrap: cannot create the node cache\n");
+    }
+}
+
 list list_create(void) {
     list l = kmalloc(sizeof(*l));
     if (l == NULL) {
@@ -148,7 +159,7 @@ void *list_deleteHead(list l) {
         l->head->prev = NULL;
     }
 
-    kfree(n);
+    kmem_cache_free(node_cache, n);
 
     l->cnt--;
 
@@ -171,7 +182,7 @@ void *list_deleteTail(list l) {
         l->tail->next = NULL;
     }
 
-    kfree(n);
+    kmem_cache_free(node_cache, n);
 
     l->cnt--;
 
@@ -196,7 +207,7 @@ void *list_deleteByKey(list l, const void *key, size_t key_offset, size_t key_si
                 n->prev->next = n->next;
                 n->next->prev = n->prev;
                 data = n->data;
-                kfree(n);
+                kmem_cache_free(node_cache, n);
                 l->cnt--;
             }
 
@@ -215,7 +226,7 @@ void list_destroy(list l) {
     while (n != NULL) {
         tmp = n;
         n = n->next;
-        kfree(tmp);
+        kmem_cache_free(node_cache, tmp);
     }
 
     kfree(l);
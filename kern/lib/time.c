@@ -67,3 +67,29 @@ timespec_sub(const struct timespec *ts1,
 	r.tv_sec -= ts2->tv_sec;
 	*ret = r;
 }
+
+/*
+ * Milliseconds from ts1 to ts2 (which is later)
+ */
+unsigned long
+timespec_elapsed_ms(const struct timespec *ts1,
+		    const struct timespec *ts2)
+{
+	struct timespec d;
+
+	timespec_sub(ts2, ts1, &d);
+	return d.tv_sec * 1000 + d.tv_nsec / 1000000;
+}
+
+/*
+ * ops per second, for ops done in ms milliseconds; 0 if ms is 0
+ */
+unsigned long
+rate_per_sec(unsigned long ops, unsigned long ms)
+{
+	if (ms == 0) {
+		return 0;
+	}
+	/* ops * 1000 / ms without overflowing */
+	return (ops / ms) * 1000 + (ops % ms) * 1000 / ms;
+}
@@ -51,6 +51,7 @@
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 #include "filetable.h"
+#include <list.h>
 #include "opt-shell.h"
 /*
  * These two pieces of data are maintained by the makefiles and build system.
@@ -107,6 +108,9 @@ static void boot(void)
 
   /* Early initialization. */
   ram_bootstrap();
+#if OPT_SHELL
+  list_bootstrap();
+#endif
   proc_bootstrap();
   thread_bootstrap();
   hardclock_bootstrap();
@@ -45,8 +45,13 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <pagecache.h>
+#include <slab.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -500,6 +505,7 @@ cmd_kheapstats(int nargs, char **args)
   (void)args;
 
   kheap_printstats();
+  kmem_cache_printstats();
 
   return 0;
 }
@@ -531,6 +537,68 @@ cmd_kheapdump(int nargs, char **args)
   return 0;
 }
 
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+  (void)nargs;
+  (void)args;
+
+  kheap_profile();
+
+  return 0;
+}
+
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+  (void)nargs;
+  (void)args;
+
+  coremap_printstats();
+
+  return 0;
+}
+
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+  (void)nargs;
+  (void)args;
+
+  vmstats_print();
+
+  return 0;
+}
+
+static
+int
+cmd_sched(int nargs, char **args)
+{
+  (void)nargs;
+  (void)args;
+
+  thread_printsched();
+
+  return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_pagecachestats(int nargs, char **args)
+{
+  (void)nargs;
+  (void)args;
+
+  pagecache_printstats();
+
+  return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -600,6 +668,8 @@ static const char *testmenu[] = {
   "[tt1] Thread test 1                 ",
   "[tt2] Thread test 2                 ",
   "[tt3] Thread test 3                 ",
+  "[tt4] Thread creation benchmark     ",
+  "[tt5] Scheduler sleep test          ",
 #if OPT_NET
   "[net] Network test                  ",
 #endif
@@ -607,6 +677,8 @@ static const char *testmenu[] = {
   "[sy2] Lock test             (1)     ",
   "[sy3] CV test               (1)     ",
   "[sy4] CV test #2            (1)     ",
+  "[sy5] Lock benchmark        (1)     ",
+  "[rwt] Rwlock reader scaling test    ",
   "[semu1-22] Semaphore unit tests     ",
   "[fs1] Filesystem test               ",
   "[fs2] FS read stress                ",
@@ -614,6 +686,7 @@ static const char *testmenu[] = {
   "[fs4] FS write stress 2             ",
   "[fs5] FS long stress                ",
   "[fs6] FS create stress              ",
+  "[cmt] Coremap (buddy) test          ",
 #if OPT_SHELL
   "[lt] List test                      ",
   "[cat] Circular array test           ",
@@ -642,6 +715,13 @@ static const char *mainmenu[] = {
   "[kh] Kernel heap stats              ",
   "[khgen] Next kernel heap generation ",
   "[khdump] Dump kernel heap           ",
+  "[khprof] Top kernel heap alloc sites",
+  "[cm] Physical memory (buddy) stats  ",
+  "[vmstat] VM event counters          ",
+  "[sched] Scheduler run queues        ",
+#if !OPT_DUMBVM
+  "[pc] Text page cache stats          ",
+#endif
   "[q] Quit and shut down              ",
   NULL
 };
@@ -693,6 +773,14 @@ static struct {
   { "kh",         cmd_kheapstats },
   { "khgen",      cmd_kheapgeneration },
   { "khdump",     cmd_kheapdump },
+  { "khprof",     cmd_kheapprofile },
+  { "sched",      cmd_sched },
+  { "cm",         cmd_coremapstats },
+  { "vmstat",     cmd_vmstats },
+  { "vm",         cmd_vmstats },
+#if !OPT_DUMBVM
+  { "pc",         cmd_pagecachestats },
+#endif
 
   /* base system tests */
   { "at",   arraytest },
@@ -709,12 +797,16 @@ static struct {
   { "tt1",  threadtest },
   { "tt2",  threadtest2 },
   { "tt3",  threadtest3 },
+  { "tt4",  threadtest4 },
+  { "tt5",  threadtest5 },
   { "sy1",  semtest },
 
   /* synchronization assignment tests */
   { "sy2",  locktest },
   { "sy3",  cvtest },
   { "sy4",  cvtest2 },
+  { "sy5",  lockbench },
+  { "rwt",  rwlocktest },
 
   /* semaphore unit tests */
   { "semu1",  semu1 },
@@ -748,6 +840,9 @@ static struct {
   { "fs5",  longstress },
   { "fs6",  createstress },
 
+  /* physical memory tests */
+  { "cmt",  coremaptest },
+
 #if OPT_SHELL
   /* list tests */
   { "lt",   listtest },
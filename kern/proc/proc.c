@@ -54,6 +54,7 @@
 #include <synch.h>
 #include <limits.h>
 #include <kern/unistd.h>
+#include <slab.h>
 
 /* Max number of active processes on the system */
 #define MAX_SYSTEM_PROCS 1024
@@ -66,6 +67,9 @@
  */
 struct proc *kproc;
 
+/* Where proc structures come from */
+static struct kmem_cache *proc_cache;
+
 #if OPT_SHELL
 struct proc_table {
   /*
@@ -78,8 +82,8 @@ struct proc_table {
   size_t numprocs;
   /* next available pid */
   size_t nextpid;
-  /* lock for this struct */
-  struct spinlock lock;
+  /* lock for this struct: lookups only read it */
+  struct rwlock *lock;
 };
 
 struct proc_table *pt;
@@ -105,7 +109,10 @@ static int proc_table_create()
     return ENOMEM;
   }
 
-  spinlock_init(&pt->lock);
+  pt->lock = rwlock_create("proc_table");
+  if (pt->lock == NULL) {
+    return ENOMEM;
+  }
   pt->numprocs = 0;
   pt->nextpid = PID_MIN;
 
@@ -128,11 +135,11 @@ static int proc_table_add(struct proc *proc)
   KASSERT(proc != NULL);
   KASSERT(pt != NULL);
 
-  spinlock_acquire(&pt->lock);
+  rwlock_acquire_write(pt->lock);
 
   /* Check if there are already too many processes on the system */
   if (pt->numprocs >= (MAX_SYSTEM_PROCS - PID_MIN)) {
-    spinlock_release(&pt->lock);
+    rwlock_release_write(pt->lock);
     return ENPROC;
   }
 
@@ -162,7 +169,7 @@ static int proc_table_add(struct proc *proc)
 
   KASSERT(pt->numprocs <= (MAX_SYSTEM_PROCS - PID_MIN));
 
-  spinlock_release(&pt->lock);
+  rwlock_release_write(pt->lock);
 
   return 0;
 }
@@ -182,7 +189,7 @@ static void proc_table_remove(struct proc *proc)
 
   KASSERT((pid >= PID_MIN) && (pid <= PID_MAX));
 
-  spinlock_acquire(&pt->lock);
+  rwlock_acquire_write(pt->lock);
 
   /* Retrieve proc pointer from array of current active processes */
   p = pt->procs[PROCS_IDX(pid)];
@@ -193,7 +200,7 @@ static void proc_table_remove(struct proc *proc)
     pt->numprocs--;
   }
 
-  spinlock_release(&pt->lock);
+  rwlock_release_write(pt->lock);
 }
 
 /*
@@ -329,13 +336,13 @@ static int proc_create(const char *name, struct proc **retproc)
 {
   struct proc *proc;
 
-  proc = kmalloc(sizeof(*proc));
+  proc = kmem_cache_alloc(proc_cache);
   if (proc == NULL) {
     return ENOMEM;
   }
   proc->p_name = kstrdup(name);
   if (proc->p_name == NULL) {
-    kfree(proc);
+    kmem_cache_free(proc_cache, proc);
     return ENOMEM;
   }
 
@@ -358,23 +365,25 @@ static int proc_create(const char *name, struct proc **retproc)
   result = proc_children_create(proc);
   if (result) {
     kfree(proc->p_name);
-    kfree(proc);
+    kmem_cache_free(proc_cache, proc);
     return result;
   }
 
   if (strcmp(name, "[kernel]") == 0) {
     proc->p_parent_pid = 0;
     proc->p_pid = 1;
-    spinlock_acquire(&pt->lock);
+    /*
+     * This is proc_bootstrap, before thread_bootstrap: there's no
+     * curthread to take the lock with, and nobody else to keep out.
+     */
     pt->procs[proc->p_pid] = proc;
-    spinlock_release(&pt->lock);
   } else {
     proc->p_parent_pid = curproc->p_pid;
     result = proc_table_add(proc);
     if (result) {
       proc_children_destroy(proc);
       kfree(proc->p_name);
-      kfree(proc);
+      kmem_cache_free(proc_cache, proc);
       return result;
     }
   }
@@ -384,7 +393,7 @@ static int proc_create(const char *name, struct proc **retproc)
     proc_table_remove(proc);
     proc_children_destroy(proc);
     kfree(proc->p_name);
-    kfree(proc);
+    kmem_cache_free(proc_cache, proc);
     return result;
   }
 
@@ -394,7 +403,7 @@ static int proc_create(const char *name, struct proc **retproc)
     proc_table_remove(proc);
     proc_children_destroy(proc);
     kfree(proc->p_name);
-    kfree(proc);
+    kmem_cache_free(proc_cache, proc);
     return ENOMEM;
   }
 #endif
@@ -490,7 +499,7 @@ void proc_destroy(struct proc *proc)
   spinlock_cleanup(&proc->p_lock);
 
   kfree(proc->p_name);
-  kfree(proc);
+  kmem_cache_free(proc_cache, proc);
 }
 /*
  * Create the process structure for the kernel.
@@ -499,6 +508,11 @@ void proc_bootstrap(void)
 {
   int result;
 
+  proc_cache = kmem_cache_create("proc", sizeof(struct proc), NULL, NULL);
+  if (proc_cache == NULL) {
+    panic("proc_bootstrap: cannot create the proc cache\n");
+  }
+
 #if OPT_SHELL
   result = proc_table_create();
   if (result) {
@@ -670,9 +684,9 @@ int proc_table_search(pid_t pid, struct proc **retproc)
     return ESRCH;
   }
 
-  spinlock_acquire(&pt->lock);
+  rwlock_acquire_read(pt->lock);
   p = pt->procs[PROCS_IDX(pid)];
-  spinlock_release(&pt->lock);
+  rwlock_release_read(pt->lock);
 
   if (p == NULL) {
     return ESRCH;
@@ -686,12 +700,11 @@ int proc_table_search(pid_t pid, struct proc **retproc)
 }
 
 /*
- * Wait for process termination, destroy the process, and return exit status.
+ * Wait for process termination and return exit status, leaving the process to be destroyed by the caller.
+ * It may be called again on the same process: p_exited is set before the process signals its exit.
  */
-int proc_wait(struct proc *proc)
+int proc_waitexit(struct proc *proc)
 {
-  int exit_status;
-
   KASSERT(proc != NULL);
   KASSERT(proc != kproc);
 
@@ -703,8 +716,18 @@ int proc_wait(struct proc *proc)
     P(proc->p_sem);
   }
 
+  return proc->p_exit_status;
+}
+
+/*
+ * Wait for process termination, destroy the process, and return exit status.
+ */
+int proc_wait(struct proc *proc)
+{
+  int exit_status;
+
   /* Save exit status */
-  exit_status = proc->p_exit_status;
+  exit_status = proc_waitexit(proc);
 
   /* Destroy the process structure */
   proc_destroy(proc);
@@ -15,23 +15,23 @@
 
 int sys_chdir(const char *pathname, int *errp)
 {
-  int len, result;
+  int result;
   char *kpath;
 
-  if (pathname == NULL || !as_check_addr(curproc->p_addrspace, (vaddr_t)pathname)) {
+  if (pathname == NULL) {
     *errp = EFAULT;
     return -1;
   }
 
-  len = strlen(pathname) + 1;
-
-  kpath = kmalloc(len * sizeof(char));
+  /* A bad path pointer faults in copyinstr */
+  kpath = kmalloc(PATH_MAX * sizeof(char));
   if (kpath == NULL) {
     *errp = ENOMEM;
     return -1;
   }
-  result = copyin((const_userptr_t)pathname, kpath, len);
+  result = copyinstr((const_userptr_t)pathname, kpath, PATH_MAX, NULL);
   if (result) {
+    kfree(kpath);
     *errp = result;
     return -1;
   }
@@ -53,7 +53,8 @@ int sys___getcwd(char *ptr, size_t bufflen, int *errp)
   struct uio u;
   int result;
 
-  if (ptr == NULL || !as_check_addr(curproc->p_addrspace, (vaddr_t)ptr)) {
+  /* Bad addresses in the buffer fault in uiomove and give EFAULT */
+  if (ptr == NULL) {
     *errp = EFAULT;
     return -1;
   }
@@ -18,19 +18,17 @@ static void free_kprogname(char *kprogname)
 
 static int alloc_kprogname(const char *progname, char **kprogname)
 {
-  size_t len;
   char *_kprogname;
   int result;
 
   /* Allocate kernel memory for progname */
-  len = strlen(progname) + 1;
-  _kprogname = kmalloc(len * sizeof(*_kprogname));
+  _kprogname = kmalloc(PATH_MAX * sizeof(*_kprogname));
   if (_kprogname == NULL) {
     return ENOMEM;
   }
 
-  /* Copy progname from user to kernel memory. */
-  result = copyin((const_userptr_t)progname, _kprogname, len);
+  /* Copy progname from user to kernel memory; a bad pointer faults there. */
+  result = copyinstr((const_userptr_t)progname, _kprogname, PATH_MAX, NULL);
   if (result) {
     /* Free kernel memory allocated for progname. */
     free_kprogname(_kprogname);
@@ -53,21 +51,36 @@ static void free_kargs(int kargc, char **kargs)
   kfree(kargs);
 }
 
+/*
+ * Copy the argument vector ARGS into kernel memory. The user pointers
+ * are only touched through copyin/copyinstr, which fail with EFAULT
+ * if they are bad.
+ */
 static int alloc_kargs(char **args, int *kargc, char ***kargs)
 {
-  char **tmp, **_kargs;
+  char **_kargs, *karg, *kbuf;
   size_t total_size, len;
   int _kargc, n, result;
 
   KASSERT(curproc != NULL);
 
   /* Get argc */
-  tmp = args;
   _kargc = 0;
-  while (*tmp != NULL) {
-    _kargc++;
-    tmp++;
-  }
+  total_size = sizeof(*_kargs);
+  do {
+    result = copyin((const_userptr_t)&args[_kargc], &karg, sizeof(karg));
+    if (result) {
+      return result;
+    }
+    if (karg != NULL) {
+      _kargc++;
+      /* Even the pointers alone must not exceed ARG_MAX */
+      total_size += sizeof(*_kargs);
+      if (total_size > ARG_MAX) {
+        return E2BIG;
+      }
+    }
+  } while (karg != NULL);
 
   /* Allocate kernel memory for args */
   _kargs = kmalloc((_kargc + 1) * sizeof(*_kargs));
@@ -75,46 +88,55 @@ static int alloc_kargs(char **args, int *kargc, char ***kargs)
     return ENOMEM;
   }
 
+  /* Strings are copied in here first, as their length isn't known yet */
+  kbuf = kmalloc(ARG_MAX);
+  if (kbuf == NULL) {
+    kfree(_kargs);
+
+    return ENOMEM;
+  }
+
   /* Copy args from user to kernel memory. */
-  n = 0;
   _kargs[_kargc] = NULL;
-  total_size = sizeof(*_kargs);
-  while (args[n] != NULL) {
-    /* Check if the argument string is in the address space of the current process. */
-    if (!as_check_addr(curproc->p_addrspace, (vaddr_t)args[n])) {
-      free_kargs(n, _kargs);
-
-      return EFAULT;
+  for (n = 0; n < _kargc; n++) {
+    /* Fetch the pointer again: the user may have changed it meanwhile */
+    result = copyin((const_userptr_t)&args[n], &karg, sizeof(karg));
+    if (result == 0 && karg == NULL) {
+      result = EFAULT;
     }
 
-    /* Check if the total size of the argument strings (plus size of pointers) exceeeds ARG_MAX */
-    len = strlen(args[n]) + 1;
-    total_size += (len + sizeof(*_kargs));
-    if (total_size > ARG_MAX) {
+    /*
+     * Copy the argument string; it must fit in what is left of
+     * ARG_MAX (the pointers were already counted).
+     */
+    if (result == 0) {
+      result = copyinstr((const_userptr_t)karg, kbuf,
+        ARG_MAX - total_size, &len);
+      if (result == ENAMETOOLONG) {
+        result = E2BIG;
+      }
+    }
+    if (result) {
+      kfree(kbuf);
       free_kargs(n, _kargs);
 
-      return E2BIG;
+      return result;
     }
+    total_size += len;
 
     /* Allocate kernel memory for argument string */
-    _kargs[n] = kmalloc(len * sizeof(*_kargs));
+    _kargs[n] = kmalloc(len * sizeof(**_kargs));
     if (_kargs[n] == NULL) {
+      kfree(kbuf);
       free_kargs(n, _kargs);
 
       return ENOMEM;
     }
-
-    /* Copy argument string from user to kernel memory. */
-    result = copyin((const_userptr_t)args[n], _kargs[n], len);
-    if (result) {
-      free_kargs(n + 1, _kargs);
-
-      return result;
-    }
-
-    n++;
+    memcpy(_kargs[n], kbuf, len);
   }
 
+  kfree(kbuf);
+
   *kargc = _kargc;
   *kargs = _kargs;
 
@@ -235,9 +257,9 @@ int sys_execv(const char *progname, char **args, int *errp)
 
   /*
    * Check if the progname argument is an invalid pointer.
-   * The progname argument should be in the address space of the current process.
+   * Other bad pointers fault when copied in.
    */
-  if ((progname == NULL) || !as_check_addr(curproc->p_addrspace, (vaddr_t)progname)) {
+  if (progname == NULL) {
     *errp = EFAULT;
     return -1;
   }
@@ -251,9 +273,12 @@ int sys_execv(const char *progname, char **args, int *errp)
 
   /*
    * Check if the args argument is an invalid pointer.
-   * The args argument should be in the address space of the current process.
+   * Other bad pointers fault when copied in.
    */
-  if ((args == NULL) || !as_check_addr(curproc->p_addrspace, (vaddr_t)args)) {
+  if (args == NULL) {
+    /* Free kernel memory allocated for progname. */
+    free_kprogname(kprogname);
+
     *errp = EFAULT;
     return -1;
   }
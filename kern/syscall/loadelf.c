@@ -42,8 +42,9 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * With the paging VM (no dumbvm), segments are not read here: each one
+ * is just tied to its place in the file with as_define_file, and pages
+ * are read from the executable by vm_fault on first access.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -59,6 +60,9 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-dumbvm.h"
+
+#if OPT_DUMBVM
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -144,6 +148,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
   return result;
 }
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -288,9 +293,15 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
         return ENOEXEC;
     }
 
+#if OPT_DUMBVM
     result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
       ph.p_memsz, ph.p_filesz,
       ph.p_flags & PF_X);
+#else
+    /* Pages are read from the file on first access */
+    result = as_define_file(as, v, ph.p_offset, ph.p_vaddr,
+      ph.p_memsz, ph.p_filesz);
+#endif
     if (result) {
       return result;
     }
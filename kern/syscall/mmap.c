@@ -0,0 +1,148 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <syscall.h>
+#include <lib.h>
+#include <limits.h>
+#include <vnode.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include "item.h"
+#include "opt-dumbvm.h"
+
+/*
+ * mmap, munmap and msync syscalls. The mappings themselves are
+ * regions of the address space (see as_mmap): pages are read from
+ * the file by vm_fault when first touched, so reading a mapped file
+ * costs one copy from the file system instead of a second one
+ * through a user buffer.
+ */
+
+#if OPT_DUMBVM
+
+/* dumbvm has no room for mappings */
+void *sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+               off_t offset, int *errp)
+{
+  (void)addr; (void)len; (void)prot; (void)flags; (void)fd; (void)offset;
+  *errp = ENOSYS;
+  return MAP_FAILED;
+}
+
+int sys_munmap(userptr_t addr, size_t len, int *errp)
+{
+  (void)addr; (void)len;
+  *errp = ENOSYS;
+  return -1;
+}
+
+int sys_msync(userptr_t addr, size_t len, int flags, int *errp)
+{
+  (void)addr; (void)len; (void)flags;
+  *errp = ENOSYS;
+  return -1;
+}
+
+#else
+
+void *sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+               off_t offset, int *errp)
+{
+  struct vnode *v = NULL;
+  struct stat st;
+  size_t filesz = 0;
+  vaddr_t vaddr;
+  int rgflags, accmode, result;
+  fcb file;
+
+  /* The address is only a hint, and we take none */
+  (void)addr;
+
+  if (len == 0 || (offset % PAGE_SIZE) != 0 || offset < 0 ||
+      ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+    *errp = EINVAL;
+    return MAP_FAILED;
+  }
+
+  rgflags = ((prot & PROT_READ) ? RG_R : 0) |
+    ((prot & PROT_WRITE) ? RG_W : 0) | ((prot & PROT_EXEC) ? RG_X : 0);
+
+  if (!(flags & MAP_ANON)) {
+    if (fd < 0 || fd >= OPEN_MAX) {
+      *errp = EBADF;
+      return MAP_FAILED;
+    }
+    file = sys_fileTable_get(proc_fileTable_get(curproc, fd));
+    if (file == NULL) {
+      *errp = EBADF;
+      return MAP_FAILED;
+    }
+
+    /* Reading the pages needs read access, writing them back write */
+    accmode = file->flag & O_ACCMODE;
+    if (accmode == O_WRONLY ||
+        ((flags & MAP_SHARED) && (prot & PROT_WRITE) && accmode != O_RDWR)) {
+      *errp = EACCES;
+      return MAP_FAILED;
+    }
+
+    v = file->vn;
+    result = VOP_MMAP(v);
+    if (result == 0) {
+      result = VOP_STAT(v, &st);
+    }
+    if (result) {
+      *errp = result == ENOSYS ? ENODEV : result;
+      return MAP_FAILED;
+    }
+    if (st.st_size > offset) {
+      filesz = st.st_size - offset < (off_t)len ? st.st_size - offset : len;
+    }
+
+    if (flags & MAP_SHARED) {
+      rgflags |= RG_SHARED;
+    }
+  }
+
+  result = as_mmap(proc_getas(), len, rgflags, v, offset, filesz, &vaddr);
+  if (result) {
+    *errp = result;
+    return MAP_FAILED;
+  }
+
+  return (void *)vaddr;
+}
+
+int sys_munmap(userptr_t addr, size_t len, int *errp)
+{
+  int result;
+
+  result = as_munmap(proc_getas(), (vaddr_t)addr, len);
+  if (result) {
+    *errp = result;
+    return -1;
+  }
+
+  return 0;
+}
+
+int sys_msync(userptr_t addr, size_t len, int flags, int *errp)
+{
+  int result;
+
+  /* Write-back is always synchronous */
+  (void)flags;
+
+  result = as_msync(proc_getas(), (vaddr_t)addr, len);
+  if (result) {
+    *errp = result;
+    return -1;
+  }
+
+  return 0;
+}
+
+#endif /* OPT_DUMBVM */
@@ -21,27 +21,27 @@ int sys_open(userptr_t path, int openflags, mode_t mode, int *errp)
 {
   int fd, indTable;
   struct vnode *v;
-  int len, result;
+  int result;
   fcb newFile;
   struct proc *p;
   char *kpath;
 
   p = curproc;
 
-  if (path == NULL || !as_check_addr(curproc->p_addrspace, (vaddr_t)path)) {
+  if (path == NULL) {
     *errp = EFAULT;
     return -1;
   }
 
-  len = strlen((char *)path) + 1;
-
-  kpath = kmalloc(len * sizeof(char));
+  /* A bad path pointer faults in copyinstr */
+  kpath = kmalloc(PATH_MAX * sizeof(char));
   if (kpath == NULL) {
     *errp = ENOMEM;
     return -1;
   }
-  result = copyin((const_userptr_t)path, kpath, len);
+  result = copyinstr((const_userptr_t)path, kpath, PATH_MAX, NULL);
   if (result) {
+    kfree(kpath);
     *errp = result;
     return -1;
   }
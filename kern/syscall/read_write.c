@@ -29,7 +29,8 @@ static int file_write(int fd, userptr_t buf_ptr, size_t size, int *errp)
     return -1;
   }
 
-  if (buf_ptr == NULL || !as_check_addr(curproc->p_addrspace, (vaddr_t)buf_ptr)) {
+  /* Bad addresses in the buffer fault in uiomove and give EFAULT */
+  if (buf_ptr == NULL) {
     *errp = EFAULT;
     return -1;
   }
@@ -82,19 +83,38 @@ static int file_write(int fd, userptr_t buf_ptr, size_t size, int *errp)
   return (nwrite);
 }
 
+/* console i/o goes through a small kernel buffer */
+#define CONSBUF_SIZE 64
+
 int sys_write(int fd, userptr_t buf_ptr, size_t size, int *errp)
 {
-  int i;
-  char *p = (char *)buf_ptr;
+  char kbuf[CONSBUF_SIZE];
+  size_t done, len, i;
+  int result;
 
   if (fd != STDOUT_FILENO && fd != STDERR_FILENO)
     return file_write(fd, buf_ptr, size, errp);
 
-  for (i = 0; i < (int)size; i++) {
-    putch(p[i]);
+  for (done = 0; done < size; done += len) {
+    len = size - done;
+    if (len > CONSBUF_SIZE) {
+      len = CONSBUF_SIZE;
+    }
+    result = copyin((const_userptr_t)(buf_ptr + done), kbuf, len);
+    if (result) {
+      if (done > 0) {
+        /* Report the partial write */
+        break;
+      }
+      *errp = result;
+      return -1;
+    }
+    for (i = 0; i < len; i++) {
+      putch(kbuf[i]);
+    }
   }
 
-  return (int)size;
+  return (int)done;
 }
 
 
@@ -114,7 +134,8 @@ static int file_read(int fd, userptr_t buf_ptr, size_t size, int *errp)
     return -1;
   }
 
-  if (buf_ptr == NULL || !as_check_addr(curproc->p_addrspace, (vaddr_t)buf_ptr)) {
+  /* Bad addresses in the buffer fault in uiomove and give EFAULT */
+  if (buf_ptr == NULL) {
     *errp = EFAULT;
     return -1;
   }
@@ -155,8 +176,8 @@ static int file_read(int fd, userptr_t buf_ptr, size_t size, int *errp)
 
 int sys_read(int fd, userptr_t buf_ptr, size_t size, int *errp)
 {
-  int i;
-  char *buff = (char *)buf_ptr;
+  int i, result;
+  char ch;
 
 
   if (fd != STDIN_FILENO) {
@@ -164,9 +185,14 @@ int sys_read(int fd, userptr_t buf_ptr, size_t size, int *errp)
   }
 
   for (i = 0; i < (int)size; i++) {
-    buff[i] = getch();
-    if (buff[i] < 0)
+    ch = getch();
+    if (ch < 0)
       return i;
+    result = copyout(&ch, buf_ptr + i, 1);
+    if (result) {
+      *errp = result;
+      return -1;
+    }
   }
 
   return (int)size;
@@ -0,0 +1,35 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <syscall.h>
+#include <lib.h>
+#include <proc.h>
+#include <addrspace.h>
+#include "opt-dumbvm.h"
+
+/*
+ * sbrk syscall - move the end of the heap, returning the old one
+ */
+void *sys_sbrk(intptr_t amount, int *errp)
+{
+#if OPT_DUMBVM
+  /* dumbvm has no heap region */
+  (void)amount;
+  *errp = ENOSYS;
+  return (void *)-1;
+#else
+  struct addrspace *as;
+  vaddr_t oldbreak;
+  int result;
+
+  as = proc_getas();
+  KASSERT(as != NULL);
+
+  result = as_sbrk(as, amount, &oldbreak);
+  if (result) {
+    *errp = result;
+    return (void *)-1;
+  }
+
+  return (void *)oldbreak;
+#endif
+}
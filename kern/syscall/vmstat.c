@@ -0,0 +1,31 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <syscall.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <vmstats.h>
+
+/*
+ * vmstat syscall - copy up to N VM event counters, summed over all
+ * cpus, to the user array COUNTS; return how many were copied
+ */
+int sys_vmstat(userptr_t counts, int n, int *errp)
+{
+  unsigned long kcounts[VMS_NSTATS];
+  unsigned got;
+  int result;
+
+  if (n < 0) {
+    *errp = EINVAL;
+    return -1;
+  }
+
+  got = vmstats_get(kcounts, (unsigned)n);
+  result = copyout(kcounts, counts, got * sizeof(kcounts[0]));
+  if (result) {
+    *errp = result;
+    return -1;
+  }
+
+  return (int)got;
+}
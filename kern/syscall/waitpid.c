@@ -5,8 +5,8 @@
 #include <lib.h>
 #include <proc.h>
 #include <thread.h>
-#include <addrspace.h>
 #include <current.h>
+#include <copyinout.h>
 
 /*
  * waitpid syscall - wait for a process to exit
@@ -14,7 +14,7 @@
 pid_t sys_waitpid(pid_t pid, userptr_t statusp, int options, int *errp)
 {
   struct proc *proc;
-  int result;
+  int result, status;
 
   /* Retrieve a process by its pid */
   result = proc_table_search(pid, &proc);
@@ -53,30 +53,34 @@ pid_t sys_waitpid(pid_t pid, userptr_t statusp, int options, int *errp)
 
   /*
    * The status argument can be NULL, in which case waitpid operates normally but the status value is not produced.
-   * If the status argument is not NULL, check if it is a valid pointer.
+   * If the status argument is not NULL, it should be an address multiple of 4 (integer alignment);
+   * whether it is mapped is found out by copyout.
    */
-  if ((statusp != NULL)) {
-    /*
-     * The statusp argument should be an address multiple of 4 (integer alignment)
-     * in the address space of the current process.
-     */
-    if ((((vaddr_t)statusp % 4) != 0) || !as_check_addr(curproc->p_addrspace, (vaddr_t)statusp)) {
-      /* The status argument was an invalid pointer */
-      *errp = EFAULT;
-      return -1;
-    }
+  if ((statusp != NULL) && (((vaddr_t)statusp % 4) != 0)) {
+    /* The status argument was an invalid pointer */
+    *errp = EFAULT;
+    return -1;
   }
 
-  /* Wait for process termination, destroy the process, and return exit status */
-  result = proc_wait(proc);
+  /* Wait for process termination */
+  status = proc_waitexit(proc);
 
   /*
    * If status argument is not NULL, store exit status in the integer pointed to by status argument.
    * Otherwise, waitpid operates normally but the status value is not produced.
+   * This is done before the process is destroyed: if the status argument turns out to be an invalid
+   * pointer, the process is left alone and its exit status can still be collected by another waitpid.
    */
   if (statusp != NULL) {
-    *(int *)statusp = result;
+    result = copyout(&status, statusp, sizeof(int));
+    if (result) {
+      *errp = result;
+      return -1;
+    }
   }
 
+  /* Destroy the process */
+  proc_destroy(proc);
+
   return pid;
 }
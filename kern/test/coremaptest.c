@@ -0,0 +1,302 @@
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <vm.h>
+#include <coremap.h>
+#include <test.h>
+#include "opt-dumbvm.h"
+
+#if !OPT_DUMBVM
+#include <kvmap.h>
+#endif
+
+#define NUM 24
+static const unsigned long sizes[NUM] = {
+  1, 2, 3, 1, 18, 4, 7, 1, 16, 5, 1, 9,
+  2, 31, 1, 8, 1, 3, 64, 1, 12, 2, 1, 33
+};
+
+static paddr_t blocks[NUM];
+
+////////////////////////////////////////////////////////////
+// helpers
+
+/*
+ * Fill a block with a pattern that depends on its slot.
+ */
+static void block_fill(int i)
+{
+  memset((void *)PADDR_TO_KVADDR(blocks[i]), i + 1, sizes[i] * PAGE_SIZE);
+}
+
+/*
+ * Check that nobody else scribbled on a block.
+ */
+static void block_check(int i)
+{
+  unsigned char *p = (unsigned char *)PADDR_TO_KVADDR(blocks[i]);
+  unsigned long j;
+
+  for (j = 0; j < sizes[i] * PAGE_SIZE; j++) {
+    if (p[j] != (unsigned char)(i + 1)) {
+      panic("coremaptest: block %d (%lu pages) overlaps another one\n",
+        i, sizes[i]);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////
+// tests
+
+/*
+ * Allocate blocks of assorted sizes and check they don't overlap.
+ */
+static void coremaptest_a(void)
+{
+  int i;
+
+  for (i = 0; i < NUM; i++) {
+    blocks[i] = coremap_alloc(sizes[i]);
+    if (blocks[i] == 0) {
+      panic("coremaptest: out of memory allocating %lu pages\n", sizes[i]);
+    }
+    KASSERT((blocks[i] & PAGE_FRAME) == blocks[i]);
+    block_fill(i);
+  }
+
+  for (i = 0; i < NUM; i++) {
+    block_check(i);
+  }
+}
+
+/*
+ * Free every other block, reallocate them, and free everything.
+ */
+static void coremaptest_b(void)
+{
+  int i;
+
+  for (i = 0; i < NUM; i += 2) {
+    coremap_free(blocks[i]);
+    blocks[i] = 0;
+  }
+  for (i = 1; i < NUM; i += 2) {
+    block_check(i);
+  }
+
+  for (i = 0; i < NUM; i += 2) {
+    blocks[i] = coremap_alloc(sizes[i]);
+    if (blocks[i] == 0) {
+      panic("coremaptest: out of memory allocating %lu pages\n", sizes[i]);
+    }
+    block_fill(i);
+  }
+  for (i = 0; i < NUM; i++) {
+    block_check(i);
+  }
+
+  for (i = NUM - 1; i >= 0; i--) {
+    coremap_free(blocks[i]);
+    blocks[i] = 0;
+  }
+}
+
+/*
+ * Requests larger than the largest buddy block must fail.
+ */
+static void coremaptest_c(void)
+{
+  KASSERT(coremap_alloc((1UL << COREMAP_MAXORDER) + 1) == 0);
+}
+
+/*
+ * A shared frame is only freed with its last reference.
+ */
+static void coremaptest_d(void)
+{
+  paddr_t paddr;
+  unsigned long nfree;
+
+  paddr = coremap_alloc(1);
+  if (paddr == 0) {
+    panic("coremaptest: out of memory allocating 1 page\n");
+  }
+  KASSERT(coremap_refcount(paddr) == 1);
+
+  coremap_incref(paddr);
+  coremap_incref(paddr);
+  KASSERT(coremap_refcount(paddr) == 3);
+
+  nfree = coremap_freepages();
+  coremap_free(paddr);
+  coremap_free(paddr);
+  KASSERT(coremap_refcount(paddr) == 1);
+  KASSERT(coremap_freepages() == nfree);
+
+  coremap_free(paddr);
+  KASSERT(coremap_freepages() == nfree + 1);
+}
+
+#if !OPT_DUMBVM
+
+/* Size of the block allocated in kseg2 */
+#define KVT_PAGES 4
+
+/*
+ * Take every free frame, one at a time, and return them linked through
+ * their first word. Running out makes coremap_alloc drain the per-cpu
+ * magazines and the zeroed pool, and idle cpus don't refill the pool
+ * with so few frames free, so this really gets them all.
+ */
+static paddr_t frames_takeall(void)
+{
+  paddr_t paddr, list = 0;
+
+  while ((paddr = coremap_alloc(1)) != 0) {
+    *(paddr_t *)PADDR_TO_KVADDR(paddr) = list;
+    list = paddr;
+  }
+  return list;
+}
+
+/*
+ * Free a list of frames made by frames_takeall.
+ */
+static void frames_freeall(paddr_t list)
+{
+  paddr_t paddr;
+
+  while (list != 0) {
+    paddr = list;
+    list = *(paddr_t *)PADDR_TO_KVADDR(paddr);
+    coremap_free(paddr);
+  }
+}
+
+/*
+ * With physical memory too fragmented for a multi-page block, kmalloc
+ * must map one in kseg2, and kfree give back its pages and frames.
+ *
+ * Every free frame is taken, and then those at even frame numbers are
+ * freed: no two free frames are then next to each other. The frames
+ * of the block are checked one by one, not through the global free
+ * count, which idle cpus zeroing frames keep changing.
+ */
+static void coremaptest_e(void)
+{
+  paddr_t paddr, held, kept;
+  paddr_t frames[KVT_PAGES];
+  bool found[KVT_PAGES];
+  unsigned char *p;
+  vaddr_t va;
+  unsigned long i, j;
+
+  held = frames_takeall();
+  kept = 0;
+  while (held != 0) {
+    paddr = held;
+    held = *(paddr_t *)PADDR_TO_KVADDR(paddr);
+    if ((paddr / PAGE_SIZE) % 2 == 0) {
+      coremap_free(paddr);
+    } else {
+      *(paddr_t *)PADDR_TO_KVADDR(paddr) = kept;
+      kept = paddr;
+    }
+  }
+
+  p = kmalloc(KVT_PAGES * PAGE_SIZE);
+  if (p == NULL) {
+    panic("coremaptest: kmalloc of %d pages failed when fragmented\n",
+      KVT_PAGES);
+  }
+  va = (vaddr_t)p;
+  if (va < KVMAP_BASE || va >= KVMAP_TOP) {
+    panic("coremaptest: %d-page block at 0x%x is not in kseg2\n",
+      KVT_PAGES, va);
+  }
+
+  /* Each page has a frame of its own, held by the block alone */
+  for (i = 0; i < KVT_PAGES; i++) {
+    frames[i] = kvmap_translate(va + i * PAGE_SIZE);
+    KASSERT(frames[i] != 0);
+    KASSERT(coremap_refcount(frames[i]) == 1);
+    for (j = 0; j < i; j++) {
+      KASSERT(frames[j] != frames[i]);
+    }
+    found[i] = false;
+  }
+
+  for (i = 0; i < KVT_PAGES * PAGE_SIZE; i++) {
+    p[i] = (unsigned char)(i % 251);
+  }
+  for (i = 0; i < KVT_PAGES * PAGE_SIZE; i++) {
+    if (p[i] != (unsigned char)(i % 251)) {
+      panic("coremaptest: kseg2 block reads back wrong at %lu\n", i);
+    }
+  }
+
+  kfree(p);
+  for (i = 0; i < KVT_PAGES; i++) {
+    KASSERT(kvmap_translate(va + i * PAGE_SIZE) == 0);
+  }
+
+  /* The block's frames must be among what can be allocated again */
+  held = frames_takeall();
+  for (paddr = held; paddr != 0;
+       paddr = *(paddr_t *)PADDR_TO_KVADDR(paddr)) {
+    for (i = 0; i < KVT_PAGES; i++) {
+      if (paddr == frames[i]) {
+        found[i] = true;
+      }
+    }
+  }
+  frames_freeall(held);
+  frames_freeall(kept);
+
+  for (i = 0; i < KVT_PAGES; i++) {
+    if (!found[i]) {
+      panic("coremaptest: frame 0x%x of a kseg2 block was not freed\n",
+        frames[i]);
+    }
+  }
+}
+
+#endif /* !OPT_DUMBVM */
+
+////////////////////////////////////////////////////////////
+// external interface
+
+int coremaptest(int nargs, char **args)
+{
+  unsigned long nfree;
+
+  (void)nargs;
+  (void)args;
+
+  kprintf("Testing coremap...\n");
+
+  nfree = coremap_freepages();
+
+  coremaptest_a();
+  coremaptest_b();
+  coremaptest_c();
+  coremaptest_d();
+#if !OPT_DUMBVM
+  coremaptest_e();
+#endif
+
+  /*
+   * Every page must be back on the free lists (running out of memory
+   * in coremaptest_e may have made kmalloc give back some more). The
+   * count isn't taken atomically: a frame each idle cpu is zeroing
+   * may be missing from it.
+   */
+  if (coremap_freepages() + cpu_count() < nfree) {
+    panic("coremaptest: %lu free pages before, %lu after\n",
+      nfree, coremap_freepages());
+  }
+
+  kprintf("Done.\n");
+
+  return 0;
+}
@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <vm.h> /* for PAGE_SIZE */
 #include <test.h>
 
@@ -295,6 +296,53 @@ kmalloctest3(int nargs, char **args)
 ////////////////////////////////////////////////////////////
 // km4
 
+/*
+ * After the multipage part, each thread churns through this many
+ * subpage allocations, keeping up to NUM_KM4_SUBSLOTS of them live at
+ * a time. This is what the per-cpu magazines in kmalloc are for, so
+ * it gets the bulk of the operations in the throughput figure.
+ */
+#define NUM_KM4_SUBTRIES 20000
+#define NUM_KM4_SUBSLOTS 8
+
+/* kmalloc and kfree calls made by each thread */
+#define KM4_OPS_PER_THREAD (2 * (NTRIES + NUM_KM4_SUBTRIES))
+
+static
+void
+kmalloctest4subpage(unsigned long num)
+{
+#define NUM_KM4_SUBSIZES 7
+	static const unsigned sizes[NUM_KM4_SUBSIZES] =
+		{ 16, 40, 100, 24, 250, 60, 500 };
+
+	void *ptrs[NUM_KM4_SUBSLOTS];
+	unsigned i, slot;
+
+	for (i=0; i<NUM_KM4_SUBSLOTS; i++) {
+		ptrs[i] = NULL;
+	}
+
+	for (i=0; i<NUM_KM4_SUBTRIES; i++) {
+		slot = (i * 5 + num) % NUM_KM4_SUBSLOTS;
+		if (ptrs[slot] != NULL) {
+			kfree(ptrs[slot]);
+		}
+		ptrs[slot] = kmalloc(sizes[i % NUM_KM4_SUBSIZES]);
+		if (ptrs[slot] == NULL) {
+			panic("kmalloctest4: thread %lu: "
+			      "allocating %u bytes failed\n",
+			      num, sizes[i % NUM_KM4_SUBSIZES]);
+		}
+	}
+
+	for (i=0; i<NUM_KM4_SUBSLOTS; i++) {
+		if (ptrs[i] != NULL) {
+			kfree(ptrs[i]);
+		}
+	}
+}
+
 static
 void
 kmalloctest4thread(void *sm, unsigned long num)
@@ -334,6 +382,8 @@ kmalloctest4thread(void *sm, unsigned long num)
 		}
 	}
 
+	kmalloctest4subpage(num);
+
 	V(sem);
 }
 
@@ -341,6 +391,8 @@ int
 kmalloctest4(int nargs, char **args)
 {
 	struct semaphore *sem;
+	struct timespec before, after;
+	unsigned long ops, ms;
 	unsigned nthreads;
 	unsigned i;
 	int result;
@@ -361,6 +413,7 @@ kmalloctest4(int nargs, char **args)
 	/* use 6 instead of 8 threads */
 	nthreads = (3*NTHREADS)/4;
 
+	gettime(&before);
 	for (i=0; i<nthreads; i++) {
 		result = thread_fork("kmalloctest4", NULL,
 				     kmalloctest4thread, sem, i);
@@ -373,8 +426,18 @@ kmalloctest4(int nargs, char **args)
 	for (i=0; i<nthreads; i++) {
 		P(sem);
 	}
+	gettime(&after);
 
 	sem_destroy(sem);
+
+	ops = nthreads * KM4_OPS_PER_THREAD;
+	ms = timespec_elapsed_ms(&before, &after);
+	kprintf("kmalloctest4: %lu kmalloc/kfree calls in %lu.%03lu seconds",
+		ops, ms / 1000, ms % 1000);
+	if (ms > 0) {
+		kprintf(" (%lu per second)", rate_per_sec(ops, ms));
+	}
+	kprintf("\n");
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
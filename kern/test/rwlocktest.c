@@ -0,0 +1,240 @@
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+/*
+ * Reader-writer lock test.
+ *
+ * First readers and writers go at a table together, checking that no
+ * reader ever sees a writer at work or a half-written table. Then the
+ * same lookups are timed with readers only, with one reader thread
+ * per cpu for 1, 2, ... all the cpus, under the rwlock and (for
+ * comparison) under a plain lock. With the rwlock, the reads done per
+ * second should grow with the number of readers.
+ */
+
+#define RWT_TABLE    32     /* entries in the table */
+#define RWT_READS    4000   /* lookups per reader thread */
+#define RWT_WRITES   300    /* updates per writer thread */
+#define RWT_READERS  6      /* readers in the first part */
+#define RWT_WRITERS  2      /* writers in the first part */
+
+#define RWT_RWLOCK   0      /* reader mode: use the rwlock */
+#define RWT_LOCK     1      /* reader mode: use the plain lock */
+
+static struct rwlock *rwt_rwlock;
+static struct lock *rwt_lock;
+static struct semaphore *rwt_done;
+static volatile unsigned rwt_table[RWT_TABLE];
+
+/* who is inside the rwlock, for the checks */
+static struct spinlock rwt_countlock = SPINLOCK_INITIALIZER;
+static unsigned rwt_nreaders;
+static unsigned rwt_nwriters;
+
+////////////////////////////////////////////////////////////
+// helpers
+
+/*
+ * Look through the table; every entry must be the same.
+ */
+static unsigned rwt_lookup(void)
+{
+  unsigned i, first;
+
+  first = rwt_table[0];
+  for (i = 1; i < RWT_TABLE; i++) {
+    if (rwt_table[i] != first) {
+      panic("rwlocktest: reader saw a half-written table\n");
+    }
+  }
+  return first;
+}
+
+static void rwt_enter(bool writer)
+{
+  spinlock_acquire(&rwt_countlock);
+  if (writer) {
+    rwt_nwriters++;
+  } else {
+    rwt_nreaders++;
+  }
+  if (rwt_nwriters > 1 || (rwt_nwriters > 0 && rwt_nreaders > 0)) {
+    panic("rwlocktest: %u readers and %u writers in the lock\n",
+      rwt_nreaders, rwt_nwriters);
+  }
+  spinlock_release(&rwt_countlock);
+}
+
+static void rwt_leave(bool writer)
+{
+  spinlock_acquire(&rwt_countlock);
+  if (writer) {
+    rwt_nwriters--;
+  } else {
+    rwt_nreaders--;
+  }
+  spinlock_release(&rwt_countlock);
+}
+
+////////////////////////////////////////////////////////////
+// threads
+
+static void rwt_checkreader(void *junk, unsigned long num)
+{
+  unsigned i;
+
+  (void)junk;
+  (void)num;
+
+  for (i = 0; i < RWT_READS; i++) {
+    rwlock_acquire_read(rwt_rwlock);
+    rwt_enter(false);
+    rwt_lookup();
+    rwt_leave(false);
+    rwlock_release_read(rwt_rwlock);
+  }
+  V(rwt_done);
+}
+
+static void rwt_checkwriter(void *junk, unsigned long num)
+{
+  unsigned i, j, val;
+
+  (void)junk;
+
+  for (i = 0; i < RWT_WRITES; i++) {
+    rwlock_acquire_write(rwt_rwlock);
+    KASSERT(rwlock_do_i_hold_write(rwt_rwlock));
+    rwt_enter(true);
+    val = rwt_lookup() + num + 1;
+    for (j = 0; j < RWT_TABLE; j++) {
+      rwt_table[j] = val;
+      /* give readers a chance to see a half-written table */
+      if (j == RWT_TABLE / 2) {
+        thread_yield();
+      }
+    }
+    rwt_leave(true);
+    rwlock_release_write(rwt_rwlock);
+  }
+  V(rwt_done);
+}
+
+static void rwt_reader(void *junk, unsigned long mode)
+{
+  unsigned i;
+
+  (void)junk;
+
+  for (i = 0; i < RWT_READS; i++) {
+    if (mode == RWT_RWLOCK) {
+      rwlock_acquire_read(rwt_rwlock);
+      rwt_lookup();
+      rwlock_release_read(rwt_rwlock);
+    } else {
+      lock_acquire(rwt_lock);
+      rwt_lookup();
+      lock_release(rwt_lock);
+    }
+  }
+  V(rwt_done);
+}
+
+////////////////////////////////////////////////////////////
+// test
+
+static void rwt_fork(const char *name,
+                     void (*func)(void *, unsigned long),
+                     unsigned long arg)
+{
+  int result;
+
+  result = thread_fork(name, NULL, func, NULL, arg);
+  if (result) {
+    panic("rwlocktest: thread_fork failed: %s\n", strerror(result));
+  }
+}
+
+/*
+ * Run NTHREADS readers in MODE; return the time they took, in ms.
+ */
+static unsigned long rwt_time(unsigned nthreads, unsigned long mode)
+{
+  struct timespec before, after;
+  unsigned i;
+
+  gettime(&before);
+  for (i = 0; i < nthreads; i++) {
+    rwt_fork("rwlocktest", rwt_reader, mode);
+  }
+  for (i = 0; i < nthreads; i++) {
+    P(rwt_done);
+  }
+  gettime(&after);
+
+  return timespec_elapsed_ms(&before, &after);
+}
+
+int rwlocktest(int nargs, char **args)
+{
+  unsigned i, n, ncpus;
+  unsigned long ops, ms;
+
+  (void)nargs;
+  (void)args;
+
+  rwt_rwlock = rwlock_create("rwlocktest");
+  rwt_lock = lock_create("rwlocktest");
+  rwt_done = sem_create("rwlocktest", 0);
+  if (rwt_rwlock == NULL || rwt_lock == NULL || rwt_done == NULL) {
+    panic("rwlocktest: out of memory\n");
+  }
+  for (i = 0; i < RWT_TABLE; i++) {
+    rwt_table[i] = 0;
+  }
+  rwt_nreaders = rwt_nwriters = 0;
+
+  kprintf("Starting rwlock test...\n");
+
+  for (i = 0; i < RWT_READERS; i++) {
+    rwt_fork("rwlocktest", rwt_checkreader, i);
+  }
+  for (i = 0; i < RWT_WRITERS; i++) {
+    rwt_fork("rwlocktest", rwt_checkwriter, i);
+  }
+  for (i = 0; i < RWT_READERS + RWT_WRITERS; i++) {
+    P(rwt_done);
+  }
+  kprintf("rwlocktest: readers and writers kept apart\n");
+
+  ncpus = cpu_count();
+  kprintf("rwlocktest: reads per second, %u cpus\n", ncpus);
+  kprintf("  %7s %10s %10s\n", "readers", "rwlock", "lock");
+  for (n = 1; n <= ncpus; n++) {
+    ops = (unsigned long)n * RWT_READS;
+    ms = rwt_time(n, RWT_RWLOCK);
+    kprintf("  %7u %10lu", n, rate_per_sec(ops, ms));
+#if OPT_SYNCH
+    ms = rwt_time(n, RWT_LOCK);
+    kprintf(" %10lu\n", rate_per_sec(ops, ms));
+#else
+    kprintf(" %10s\n", "-");
+#endif
+  }
+
+  sem_destroy(rwt_done);
+  lock_destroy(rwt_lock);
+  rwlock_destroy(rwt_rwlock);
+  rwt_done = NULL;
+  rwt_lock = NULL;
+  rwt_rwlock = NULL;
+
+  kprintf("Rwlock test done.\n");
+  return 0;
+}
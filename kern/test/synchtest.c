@@ -399,3 +399,95 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Lock benchmark: LBTHREADS threads each take and drop one lock
+ * LBLOOPS times, with a very short critical section and a short
+ * stretch of work outside it, as with the file table locks. Reports
+ * the rate of lock_acquire/lock_release pairs and how the waits for
+ * the lock were resolved.
+ */
+
+#define LBTHREADS  8
+#define LBLOOPS    5000
+#define LBWORK     50
+
+static struct lock *lblock;
+static volatile unsigned long lbcount;
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	volatile unsigned i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<LBLOOPS; i++) {
+		lock_acquire(lblock);
+		lbcount++;
+		lock_release(lblock);
+		for (j=0; j<LBWORK; j++);
+	}
+	V(donesem);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	struct timespec before, after;
+	unsigned long ops, ms;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	lblock = lock_create("lockbench");
+	if (lblock == NULL) {
+		panic("lockbench: lock_create failed\n");
+	}
+	lbcount = 0;
+	kprintf("Starting lock benchmark...\n");
+
+	gettime(&before);
+	for (i=0; i<LBTHREADS; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<LBTHREADS; i++) {
+		P(donesem);
+	}
+	gettime(&after);
+
+	ops = LBTHREADS * LBLOOPS;
+	if (lbcount != ops) {
+		panic("lockbench: count is %lu, should be %lu\n",
+		      lbcount, ops);
+	}
+
+	ms = timespec_elapsed_ms(&before, &after);
+	kprintf("lockbench: %lu acquire/release pairs in %lu.%03lu seconds",
+		ops, ms / 1000, ms % 1000);
+	if (ms > 0) {
+		kprintf(" (%lu per second)", rate_per_sec(ops, ms));
+	}
+	kprintf("\n");
+#if OPT_SYNCH
+	kprintf("lockbench: %lu acquired by spinning, %lu sleeps\n",
+		lblock->lk_spins, lblock->lk_sleeps);
+#endif
+
+	lock_destroy(lblock);
+	lblock = NULL;
+	kprintf("Lock benchmark done.\n");
+
+	return 0;
+}
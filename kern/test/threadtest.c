@@ -32,8 +32,11 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
+#include <current.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <test.h>
 
 #define NTHREADS  8
@@ -144,3 +147,204 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Thread creation benchmark: fork threads that do nothing, one at a
+ * time, waiting for each to run before forking the next. Reports the
+ * time thread_fork itself takes and the time of the whole round trip,
+ * which also covers switching to the thread, its exit, and reaping it.
+ * Run it on an otherwise idle system.
+ */
+
+#define TT4_NTHREADS  2000
+
+static
+void
+nullthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+static
+unsigned long
+timespec_to_usec(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000UL + ts->tv_nsec / 1000;
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	struct timespec start, end, before, after, duration, forktime;
+	unsigned long totalus, forkus;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting thread creation benchmark...\n");
+
+	forktime.tv_sec = 0;
+	forktime.tv_nsec = 0;
+
+	gettime(&start);
+	for (i=0; i<TT4_NTHREADS; i++) {
+		gettime(&before);
+		result = thread_fork("threadtest4", NULL, nullthread, NULL, i);
+		gettime(&after);
+		if (result) {
+			panic("threadtest4: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+		timespec_sub(&after, &before, &duration);
+		timespec_add(&forktime, &duration, &forktime);
+		P(tsem);
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &duration);
+	totalus = timespec_to_usec(&duration);
+	forkus = timespec_to_usec(&forktime);
+	kprintf("threadtest4: %d threads in %lu.%06lu seconds\n",
+		TT4_NTHREADS, totalus / 1000000, totalus % 1000000);
+	kprintf("threadtest4: thread_fork %lu.%03lu us, "
+		"round trip %lu.%03lu us\n",
+		forkus / TT4_NTHREADS,
+		(forkus % TT4_NTHREADS) * 1000 / TT4_NTHREADS,
+		totalus / TT4_NTHREADS,
+		(totalus % TT4_NTHREADS) * 1000 / TT4_NTHREADS);
+	kprintf("Thread creation benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Scheduler test: a thread that computes until its time slice is
+ * nearly up and then sleeps for a moment, over and over, must still
+ * sink to the lowest level like any other CPU hog. The sleeps are
+ * handshakes with a helper thread, so they're much shorter than a
+ * hardclock.
+ */
+
+#define TT5_SECONDS  10
+
+static struct semaphore *tt5_ping;
+static struct semaphore *tt5_pong;
+static volatile bool tt5_done;
+static unsigned tt5_level;
+static unsigned tt5_rounds;
+
+/*
+ * Busy-wait for about half a hardclock.
+ */
+static
+void
+tt5_spin(void)
+{
+	struct timespec start, now, duration;
+
+	gettime(&start);
+	do {
+		gettime(&now);
+		timespec_sub(&now, &start, &duration);
+	} while (duration.tv_sec == 0 &&
+		 duration.tv_nsec < 1000000000 / HZ / 2);
+}
+
+static
+void
+tt5_helper(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (1) {
+		P(tt5_ping);
+		if (tt5_done) {
+			break;
+		}
+		V(tt5_pong);
+	}
+	V(tsem);
+}
+
+static
+void
+tt5_gamer(void *junk, unsigned long num)
+{
+	/* (the scheduler changes these behind the compiler's back) */
+	volatile struct thread *self = curthread;
+	struct timespec start, now;
+
+	(void)junk;
+	(void)num;
+
+	gettime(&start);
+	tt5_rounds = 0;
+	while (self->t_priority < SCHED_NLEVELS - 1) {
+		gettime(&now);
+		if (now.tv_sec - start.tv_sec >= TT5_SECONDS) {
+			break;
+		}
+		/* Run until one tick of the slice is left... */
+		while (self->t_ticks + 1 < SCHED_QUANTUM(self->t_priority)) {
+			/* spin */
+		}
+		/* ...use part of it, and nap before it runs out */
+		tt5_spin();
+		V(tt5_ping);
+		P(tt5_pong);
+		tt5_rounds++;
+	}
+	tt5_level = self->t_priority;
+
+	tt5_done = true;
+	V(tt5_ping);
+	V(tsem);
+}
+
+int
+threadtest5(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	tt5_ping = sem_create("tt5_ping", 0);
+	tt5_pong = sem_create("tt5_pong", 0);
+	if (tt5_ping == NULL || tt5_pong == NULL) {
+		panic("threadtest5: sem_create failed\n");
+	}
+	tt5_done = false;
+
+	kprintf("Starting scheduler sleep test...\n");
+
+	result = thread_fork("threadtest5", NULL, tt5_helper, NULL, 0);
+	if (result == 0) {
+		result = thread_fork("threadtest5", NULL, tt5_gamer, NULL, 0);
+	}
+	if (result) {
+		panic("threadtest5: thread_fork failed %s)\n",
+		      strerror(result));
+	}
+	P(tsem);
+	P(tsem);
+
+	sem_destroy(tt5_ping);
+	sem_destroy(tt5_pong);
+
+	kprintf("threadtest5: reached level %u of %u in %u naps\n",
+		tt5_level, SCHED_NLEVELS - 1, tt5_rounds);
+	if (tt5_level < SCHED_NLEVELS - 1) {
+		panic("threadtest5: napping kept the thread from sinking\n");
+	}
+	kprintf("Scheduler sleep test done.\n");
+
+	return 0;
+}
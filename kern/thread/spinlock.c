@@ -121,6 +121,49 @@ spinlock_acquire(struct spinlock *splk)
 	}
 }
 
+/*
+ * Get the lock if it is free, without spinning. Returns true (with
+ * interrupts disabled, as with spinlock_acquire) if we got it, and
+ * false if someone else holds it.
+ *
+ * Since a failed attempt doesn't wait, it can't deadlock; the
+ * deadlock detector is only told about the lock once we have it.
+ */
+bool
+spinlock_tryacquire(struct spinlock *splk)
+{
+	struct cpu *mycpu;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (splk->splk_holder == mycpu) {
+			panic("Deadlock on spinlock %p\n", splk);
+		}
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	if (spinlock_data_get(&splk->splk_lock) != 0 ||
+	    spinlock_data_testandset(&splk->splk_lock) != 0) {
+		spllower(IPL_HIGH, IPL_NONE);
+		return false;
+	}
+
+	membar_store_any();
+	splk->splk_holder = mycpu;
+
+	if (CURCPU_EXISTS()) {
+		mycpu->c_spinlocks++;
+		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
+	}
+	return true;
+}
+
 /*
  * Release the lock.
  */
@@ -35,6 +35,7 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
@@ -159,6 +160,8 @@ lock_create(const char *name)
   }
   lock->lk_owner = NULL;
   spinlock_init(&lock->lk_lock);
+  lock->lk_spins = 0;
+  lock->lk_sleeps = 0;
 #endif
 
   return lock;
@@ -178,10 +181,36 @@ lock_destroy(struct lock *lock)
   kfree(lock);
 }
 
+#if OPT_SYNCH
+/*
+ * Adaptive locking: a lock held by a thread that is running (on some
+ * other cpu, then) is usually released soon, sooner than it takes to
+ * sleep and be woken again, so lock_acquire spins waiting for it. It
+ * sleeps once the holder isn't running any more, or after spinning
+ * LOCK_SPIN_MAX times anyway.
+ *
+ * The holder is looked at without the spinlock while spinning. That's
+ * only a hint: a thread can't go away while it holds a lock, and the
+ * decision to sleep is taken again with the spinlock held.
+ */
+#define LOCK_SPIN_MAX 2000
+
+static
+bool
+lock_holder_running(struct lock *lock, volatile struct thread *holder)
+{
+  return lock->lk_owner == holder && holder->t_state == S_RUN;
+}
+#endif
+
 void
 lock_acquire(struct lock *lock)
 {
 #if OPT_SYNCH
+  volatile struct thread *holder;
+  unsigned spins = 0;
+  bool slept = false;
+
   KASSERT(lock != NULL);
   if (lock_do_i_hold(lock)) {
     kprintf("AAACKK!\n");
@@ -193,11 +222,27 @@ lock_acquire(struct lock *lock)
 
   spinlock_acquire(&lock->lk_lock);
   while (lock->lk_owner != NULL) {
+    holder = lock->lk_owner;
+    if (spins < LOCK_SPIN_MAX && holder->t_state == S_RUN) {
+      /* Wait for the holder without the spinlock, so it can release */
+      spinlock_release(&lock->lk_lock);
+      while (spins < LOCK_SPIN_MAX && lock_holder_running(lock, holder)) {
+        spins++;
+        membar_any_any();
+      }
+      spinlock_acquire(&lock->lk_lock);
+      continue;
+    }
+    lock->lk_sleeps++;
+    slept = true;
     wchan_sleep(lock->lk_wchan, &lock->lk_lock);
   }
 
   KASSERT(lock->lk_owner == NULL);
   lock->lk_owner = curthread;
+  if (spins > 0 && !slept) {
+    lock->lk_spins++;
+  }
   spinlock_release(&lock->lk_lock);
   return;
 #endif
@@ -222,6 +267,29 @@ lock_release(struct lock *lock)
   (void)lock; // suppress warning until code gets written
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+#if OPT_SYNCH
+  bool res;
+
+  KASSERT(lock != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+
+  spinlock_acquire(&lock->lk_lock);
+  res = lock->lk_owner == NULL;
+  if (res) {
+    lock->lk_owner = curthread;
+  }
+  spinlock_release(&lock->lk_lock);
+  return res;
+#endif
+
+  (void)lock;  // suppress warning until code gets written
+
+  return true; // dummy until code gets written
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -341,3 +409,135 @@ cv_broadcast(struct cv *cv, struct lock *lock)
   (void)cv;    // suppress warning until code gets written
   (void)lock;  // suppress warning until code gets written
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+  struct rwlock *rwlock;
+
+  rwlock = kmalloc(sizeof(*rwlock));
+  if (rwlock == NULL) {
+    return NULL;
+  }
+
+  rwlock->rwlk_name = kstrdup(name);
+  if (rwlock->rwlk_name == NULL) {
+    kfree(rwlock);
+    return NULL;
+  }
+
+  rwlock->rwlk_rwchan = wchan_create(rwlock->rwlk_name);
+  if (rwlock->rwlk_rwchan == NULL) {
+    kfree(rwlock->rwlk_name);
+    kfree(rwlock);
+    return NULL;
+  }
+  rwlock->rwlk_wwchan = wchan_create(rwlock->rwlk_name);
+  if (rwlock->rwlk_wwchan == NULL) {
+    wchan_destroy(rwlock->rwlk_rwchan);
+    kfree(rwlock->rwlk_name);
+    kfree(rwlock);
+    return NULL;
+  }
+
+  spinlock_init(&rwlock->rwlk_lock);
+  rwlock->rwlk_readers = 0;
+  rwlock->rwlk_wwaiting = 0;
+  rwlock->rwlk_writer = NULL;
+
+  return rwlock;
+}
+
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
+  KASSERT(rwlock->rwlk_readers == 0);
+  KASSERT(rwlock->rwlk_wwaiting == 0);
+  KASSERT(rwlock->rwlk_writer == NULL);
+
+  spinlock_cleanup(&rwlock->rwlk_lock);
+  wchan_destroy(rwlock->rwlk_wwchan);
+  wchan_destroy(rwlock->rwlk_rwchan);
+  kfree(rwlock->rwlk_name);
+  kfree(rwlock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+
+  spinlock_acquire(&rwlock->rwlk_lock);
+  KASSERT(rwlock->rwlk_writer != curthread);
+  /* Stand back for waiting writers, too */
+  while (rwlock->rwlk_writer != NULL || rwlock->rwlk_wwaiting > 0) {
+    wchan_sleep(rwlock->rwlk_rwchan, &rwlock->rwlk_lock);
+  }
+  rwlock->rwlk_readers++;
+  spinlock_release(&rwlock->rwlk_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
+
+  spinlock_acquire(&rwlock->rwlk_lock);
+  KASSERT(rwlock->rwlk_readers > 0);
+  rwlock->rwlk_readers--;
+  if (rwlock->rwlk_readers == 0 && rwlock->rwlk_wwaiting > 0) {
+    wchan_wakeone(rwlock->rwlk_wwchan, &rwlock->rwlk_lock);
+  }
+  spinlock_release(&rwlock->rwlk_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
+  KASSERT(curthread->t_in_interrupt == false);
+
+  spinlock_acquire(&rwlock->rwlk_lock);
+  KASSERT(rwlock->rwlk_writer != curthread);
+  rwlock->rwlk_wwaiting++;
+  while (rwlock->rwlk_writer != NULL || rwlock->rwlk_readers > 0) {
+    wchan_sleep(rwlock->rwlk_wwchan, &rwlock->rwlk_lock);
+  }
+  rwlock->rwlk_wwaiting--;
+  rwlock->rwlk_writer = curthread;
+  spinlock_release(&rwlock->rwlk_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rwlock)
+{
+  KASSERT(rwlock != NULL);
+
+  spinlock_acquire(&rwlock->rwlk_lock);
+  KASSERT(rwlock->rwlk_writer == curthread);
+  rwlock->rwlk_writer = NULL;
+  if (rwlock->rwlk_wwaiting > 0) {
+    /* Writers first; the readers get their turn when they're done */
+    wchan_wakeone(rwlock->rwlk_wwchan, &rwlock->rwlk_lock);
+  } else {
+    wchan_wakeall(rwlock->rwlk_rwchan, &rwlock->rwlk_lock);
+  }
+  spinlock_release(&rwlock->rwlk_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rwlock)
+{
+  bool res;
+
+  spinlock_acquire(&rwlock->rwlk_lock);
+  res = rwlock->rwlk_writer == curthread;
+  spinlock_release(&rwlock->rwlk_lock);
+  return res;
+}
@@ -46,9 +46,13 @@
 #include <threadprivate.h>
 #include <proc.h>
 #include <current.h>
+#include <clock.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <coremap.h>
+#include <slab.h>
 #include <mainbus.h>
+#include <platform/maxcpus.h>
 #include <vnode.h>
 
 
@@ -69,6 +73,15 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Where thread structures come from */
+static struct kmem_cache *thread_cache;
+
+/*
+ * Exited threads each cpu keeps, with their stacks, for thread_fork
+ * to reuse; see thread_recycle.
+ */
+#define THREAD_CACHE_MAX 8
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -108,6 +121,38 @@ thread_checkstack(struct thread *thread)
   }
 }
 
+/*
+ * Set up the fields of a new or reused thread, all but the name and
+ * the stack.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
+  thread->t_wchan_name = "NEW";
+  thread->t_state = S_READY;
+
+  /* Thread subsystem fields */
+  thread_machdep_init(&thread->t_machdep);
+  threadlistnode_init(&thread->t_listnode, thread);
+  thread->t_context = NULL;
+  thread->t_cpu = NULL;
+  thread->t_proc = NULL;
+
+  /* Interrupt state fields */
+  thread->t_in_interrupt = false;
+  thread->t_curspl = IPL_HIGH;
+  thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+  /* Scheduler fields: new threads start at the top */
+  thread->t_priority = 0;
+  thread->t_ticks = 0;
+  thread->t_readysince = 0;
+  thread->t_sleepsince = 0;
+
+  /* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -120,33 +165,63 @@ struct thread *
 
   DEBUGASSERT(name != NULL);
 
-  thread = kmalloc(sizeof(*thread));
+  thread = kmem_cache_alloc(thread_cache);
   if (thread == NULL) {
     return NULL;
   }
 
   thread->t_name = kstrdup(name);
   if (thread->t_name == NULL) {
-    kfree(thread);
+    kmem_cache_free(thread_cache, thread);
     return NULL;
   }
-  thread->t_wchan_name = "NEW";
-  thread->t_state = S_READY;
-
-  /* Thread subsystem fields */
-  thread_machdep_init(&thread->t_machdep);
-  threadlistnode_init(&thread->t_listnode, thread);
+  thread_init(thread);
   thread->t_stack = NULL;
-  thread->t_context = NULL;
-  thread->t_cpu = NULL;
-  thread->t_proc = NULL;
 
-  /* Interrupt state fields */
-  thread->t_in_interrupt = false;
-  thread->t_curspl = IPL_HIGH;
-  thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+  return thread;
+}
 
-  /* If you add to struct thread, be sure to initialize here */
+/*
+ * Take a thread, with its stack, from the current cpu's cache of
+ * exited threads and set it up afresh. Returns NULL if the cache is
+ * empty (or the name can't be copied). The name is only copied once
+ * there is a thread to give it to.
+ *
+ * The stack guard words need no resetting: thread_checkstack checked
+ * them every time the old thread switched out, and checks them again
+ * here.
+ */
+static
+struct thread *
+thread_reuse(const char *name)
+{
+  struct thread *thread;
+  char *namecopy;
+  int spl;
+
+  DEBUGASSERT(name != NULL);
+
+  /* The cache is per-cpu; stay on this one while using it */
+  spl = splhigh();
+  thread = threadlist_remhead(&curcpu->c_threadcache);
+  splx(spl);
+  if (thread == NULL) {
+    return NULL;
+  }
+
+  namecopy = kstrdup(name);
+  if (namecopy == NULL) {
+    /* Put it back, on whatever cpu we're on now */
+    spl = splhigh();
+    threadlist_addhead(&curcpu->c_threadcache, thread);
+    splx(spl);
+    return NULL;
+  }
+
+  KASSERT(thread->t_stack != NULL);
+  thread_checkstack(thread);
+  thread->t_name = namecopy;
+  thread_init(thread);
 
   return thread;
 }
@@ -164,6 +239,7 @@ cpu_create(unsigned hardware_number)
 {
   struct cpu *c;
   int result;
+  unsigned i;
   char namebuf[16];
 
   c = kmalloc(sizeof(*c));
@@ -176,15 +252,25 @@ cpu_create(unsigned hardware_number)
 
   c->c_curthread = NULL;
   threadlist_init(&c->c_zombies);
+  threadlist_init(&c->c_threadcache);
   c->c_hardclocks = 0;
   c->c_spinlocks = 0;
 
   c->c_isidle = false;
-  threadlist_init(&c->c_runqueue);
+  for (i = 0; i < SCHED_NLEVELS; i++) {
+    threadlist_init(&c->c_runqueue[i]);
+  }
   spinlock_init(&c->c_runqueue_lock);
+  c->c_demotions = 0;
+  c->c_boosts = 0;
+  c->c_agings = 0;
+  c->c_steals = 0;
 
   c->c_ipi_pending = 0;
   c->c_numshootdown = 0;
+  c->c_shootdownall = false;
+  c->c_shootdown_seq = 0;
+  c->c_shootdown_done = 0;
   spinlock_init(&c->c_ipi_lock);
 
   result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -248,17 +334,22 @@ cpu_create(unsigned hardware_number)
   return c;
 }
 
+unsigned
+cpu_count(void)
+{
+  return cpuarray_num(&allcpus);
+}
+
 /*
- * Destroy a thread.
+ * Clean up everything in a dead thread but the structure itself and
+ * its stack.
  *
  * This function cannot be called in the victim thread's own context.
  * Nor can it be called on a running thread.
- *
- * (Freeing the stack you're actually using to run is ... inadvisable.)
  */
 static
 void
-thread_destroy(struct thread *thread)
+thread_cleanup(struct thread *thread)
 {
   KASSERT(thread != curthread);
   KASSERT(thread->t_state != S_RUN);
@@ -270,9 +361,6 @@ thread_destroy(struct thread *thread)
 
   /* Thread subsystem fields */
   KASSERT(thread->t_proc == NULL);
-  if (thread->t_stack != NULL) {
-    kfree(thread->t_stack);
-  }
   threadlistnode_cleanup(&thread->t_listnode);
   thread_machdep_cleanup(&thread->t_machdep);
 
@@ -280,7 +368,45 @@ thread_destroy(struct thread *thread)
   thread->t_wchan_name = "DESTROYED";
 
   kfree(thread->t_name);
-  kfree(thread);
+  thread->t_name = NULL;
+}
+
+/*
+ * Destroy a thread.
+ *
+ * (Freeing the stack you're actually using to run is ... inadvisable.)
+ */
+static
+void
+thread_destroy(struct thread *thread)
+{
+  thread_cleanup(thread);
+  if (thread->t_stack != NULL) {
+    kfree(thread->t_stack);
+  }
+  kmem_cache_free(thread_cache, thread);
+}
+
+/*
+ * Keep a dead thread and its stack in the current cpu's cache for
+ * thread_reuse, if there's room; otherwise destroy it. Threads without
+ * a stack of their own (the boot thread) are always destroyed.
+ *
+ * Only called from exorcise, with interrupts off, so the cache can't
+ * be touched by anyone else meanwhile.
+ */
+static
+void
+thread_recycle(struct thread *thread)
+{
+  if (thread->t_stack == NULL ||
+      curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+    thread_destroy(thread);
+    return;
+  }
+  thread_cleanup(thread);
+  threadlistnode_init(&thread->t_listnode, thread);
+  threadlist_addhead(&curcpu->c_threadcache, thread);
 }
 
 /*
@@ -298,7 +424,7 @@ exorcise(void)
   while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
     KASSERT(z != curthread);
     KASSERT(z->t_state == S_ZOMBIE);
-    thread_destroy(z);
+    thread_recycle(z);
   }
 }
 
@@ -310,6 +436,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+  struct threadlist *rq;
+  unsigned i;
+
   /*
    * Kill off other CPUs.
    *
@@ -324,9 +453,12 @@ thread_panic(void)
    * to.  Instead, blat the list structure by hand, and take the
    * risk that it might not be quite atomic.
    */
-  curcpu->c_runqueue.tl_count = 0;
-  curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-  curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+  for (i = 0; i < SCHED_NLEVELS; i++) {
+    rq = &curcpu->c_runqueue[i];
+    rq->tl_count = 0;
+    rq->tl_head.tln_next = &rq->tl_tail;
+    rq->tl_tail.tln_prev = &rq->tl_head;
+  }
 
   /*
    * Ideally, we want to make sure sleeping threads don't wake
@@ -369,6 +501,12 @@ thread_bootstrap(void)
 {
   cpuarray_init(&allcpus);
 
+  thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+    NULL, NULL);
+  if (thread_cache == NULL) {
+    panic("thread_bootstrap: cannot create the thread cache\n");
+  }
+
   /*
    * Create the cpu structure for the bootup CPU, the one we're
    * currently running on. Assume the hardware number is 0; that
@@ -438,6 +576,141 @@ thread_start_cpus(void)
   cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queues.
+ *
+ * Each cpu has a list of ready threads per priority level (see the
+ * scheduler below). Threads are taken from the highest level that
+ * has any, round-robin within the level. All of these must be called
+ * with the cpu's run queue lock held.
+ */
+
+/*
+ * Queue T at the tail of its level.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+  KASSERT(t->t_priority < SCHED_NLEVELS);
+  t->t_readysince = c->c_hardclocks;
+  threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+}
+
+/*
+ * Take the next thread to run, or NULL if none.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+  unsigned i;
+
+  for (i = 0; i < SCHED_NLEVELS; i++) {
+    if (!threadlist_isempty(&c->c_runqueue[i])) {
+      return threadlist_remhead(&c->c_runqueue[i]);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Take the thread that would run last, or NULL if none.
+ */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+  unsigned i;
+
+  for (i = SCHED_NLEVELS; i-- > 0; ) {
+    if (!threadlist_isempty(&c->c_runqueue[i])) {
+      return threadlist_remtail(&c->c_runqueue[i]);
+    }
+  }
+  return NULL;
+}
+
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+  unsigned i, n = 0;
+
+  for (i = 0; i < SCHED_NLEVELS; i++) {
+    n += c->c_runqueue[i].tl_count;
+  }
+  return n;
+}
+
+/*
+ * Work stealing: called by an idle cpu, without its own run queue
+ * lock, to take a thread from the run queue of the most loaded other
+ * cpu. Returns the thread, now belonging to the current cpu, or NULL.
+ *
+ * The run queue counts are only read as a hint, and the chosen cpu's
+ * run queue lock is only tried, never waited for: if it's busy, its
+ * owner is already at work on the queue and we'll look again on the
+ * next pass of the idle loop. This also means we never wait for one
+ * run queue lock while holding another.
+ *
+ * Cpus that are idling themselves are left alone, as they are about
+ * to run what's on their queue anyway.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+  unsigned i, n, numcpus, most;
+  struct cpu *c, *victim;
+  struct thread *t;
+
+  victim = NULL;
+  most = 0;
+  numcpus = cpuarray_num(&allcpus);
+  for (i = 0; i < numcpus; i++) {
+    c = cpuarray_get(&allcpus, i);
+    if (c == curcpu->c_self || c->c_isidle) {
+      continue;
+    }
+    n = runqueue_count(c);
+    if (n > most) {
+      most = n;
+      victim = c;
+    }
+  }
+  if (victim == NULL) {
+    return NULL;
+  }
+
+  if (!spinlock_tryacquire(&victim->c_runqueue_lock)) {
+    return NULL;
+  }
+  /* The thread that would run last there, so probably a hog */
+  t = runqueue_remtail(victim);
+  if (t != NULL && (t == victim->c_curthread || t == curthread)) {
+    /*
+     * A thread that went to sleep, was woken, and whose cpu
+     * hasn't switched away from it yet can be both curthread
+     * there and on the run queue; see thread_consider_migration.
+     * It must not be moved. Leave it where it was.
+     */
+    threadlist_addtail(&victim->c_runqueue[t->t_priority], t);
+    t = NULL;
+  }
+  spinlock_release(&victim->c_runqueue_lock);
+  if (t == NULL) {
+    return NULL;
+  }
+
+  KASSERT(t->t_state == S_READY);
+  t->t_cpu = curcpu->c_self;
+  curcpu->c_steals++;
+  DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+    t->t_name, victim->c_number, curcpu->c_number);
+  return t;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -459,9 +732,23 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
     spinlock_acquire(&targetcpu->c_runqueue_lock);
   }
 
+  if (target->t_state == S_SLEEP && target->t_priority > 0 &&
+      targetcpu->c_hardclocks - target->t_sleepsince >=
+      SCHED_BOOST_HARDCLOCKS) {
+    /*
+     * Woken up: it was waiting rather than computing, so boost it.
+     * The ticks it used carry over, up to the new level's slice.
+     */
+    target->t_priority--;
+    if (target->t_ticks >= SCHED_QUANTUM(target->t_priority)) {
+      target->t_ticks = SCHED_QUANTUM(target->t_priority) - 1;
+    }
+    targetcpu->c_boosts++;
+  }
+
   /* Target thread is now ready to run; put it on the run queue. */
   target->t_state = S_READY;
-  threadlist_addtail(&targetcpu->c_runqueue, target);
+  runqueue_add(targetcpu, target);
 
   if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
     /*
@@ -495,18 +782,22 @@ thread_fork(const char *name,
   struct thread *newthread;
   int result;
 
-  newthread = thread_create(name);
+  /* Reuse an exited thread and its stack, or else make new ones */
+  newthread = thread_reuse(name);
   if (newthread == NULL) {
-    return ENOMEM;
-  }
+    newthread = thread_create(name);
+    if (newthread == NULL) {
+      return ENOMEM;
+    }
 
-  /* Allocate a stack */
-  newthread->t_stack = kmalloc(STACK_SIZE);
-  if (newthread->t_stack == NULL) {
-    thread_destroy(newthread);
-    return ENOMEM;
+    /* Allocate a stack */
+    newthread->t_stack = kmalloc(STACK_SIZE);
+    if (newthread->t_stack == NULL) {
+      thread_destroy(newthread);
+      return ENOMEM;
+    }
+    thread_checkstack_init(newthread);
   }
-  thread_checkstack_init(newthread);
 
   /*
    * Now we clone various fields from the parent thread.
@@ -583,7 +874,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
   spinlock_acquire(&curcpu->c_runqueue_lock);
 
   /* Micro-optimization: if nothing to do, just return */
-  if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+  if (newstate == S_READY && runqueue_count(curcpu) == 0) {
     spinlock_release(&curcpu->c_runqueue_lock);
     splx(spl);
     return;
@@ -598,6 +889,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
       break;
     case S_SLEEP:
       cur->t_wchan_name = wc->wc_name;
+      cur->t_sleepsince = curcpu->c_hardclocks;
       /*
        * Add the thread to the list in the wait channel, and
        * unlock same. To avoid a race with someone else
@@ -636,10 +928,20 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
   /* The current cpu is now idle. */
   curcpu->c_isidle = true;
   do {
-    next = threadlist_remhead(&curcpu->c_runqueue);
+    next = runqueue_remhead(curcpu);
     if (next == NULL) {
       spinlock_release(&curcpu->c_runqueue_lock);
-      cpu_idle();
+      /*
+       * Make ourselves useful: take work from a busier cpu,
+       * or else zero a frame and idle. Interrupts are off the
+       * whole time and only come in during cpu_idle, so zero
+       * no more than one frame per pass.
+       */
+      next = thread_steal();
+      if (next == NULL) {
+        coremap_idle_zero();
+        cpu_idle();
+      }
       spinlock_acquire(&curcpu->c_runqueue_lock);
     }
   } while (next == NULL);
@@ -766,7 +1068,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
  *
  * The parts of the thread structure we don't actually need to run
  * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
+ * exorcise() recycles or destroys the thread.
  *
  * Does not return.
  */
@@ -811,19 +1113,113 @@ thread_yield(void)
 ////////////////////////////////////////////////////////////
 
 /*
- * Scheduler.
+ * Scheduler: a multilevel feedback queue per cpu.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Threads start at level 0, the highest. A thread that runs for its
+ * whole time slice, which doubles at each level down, moves down a
+ * level: CPU hogs sink and get longer but rarer slices. A thread
+ * woken up from wchan_sleep after sleeping for SCHED_BOOST_HARDCLOCKS
+ * moves up a level, so threads that mostly wait (for the console, the
+ * disk, other threads) stay near the top. Ticks are charged across
+ * sleeps, and brief sleeps earn no boost, so sleeping just before the
+ * slice is up doesn't keep a thread from sinking.
+ *
+ * A running thread yields at the next tick when a thread of a higher
+ * level is ready. To keep the low levels from starving, schedule()
+ * moves threads that have been waiting for SCHED_AGE_HARDCLOCKS up a
+ * level.
  */
 
+/* Wait this long in a run queue before moving up a level */
+#define SCHED_AGE_HARDCLOCKS HZ
+
+/*
+ * This is called periodically from hardclock(): age the threads
+ * waiting in the current CPU's run queue.
+ */
 void
 schedule(void)
 {
-  /*
-   * You can write this. If we do nothing, threads will run in
-   * round-robin fashion.
-   */
+  struct thread *t;
+  unsigned level;
+
+  spinlock_acquire(&curcpu->c_runqueue_lock);
+  for (level = 1; level < SCHED_NLEVELS; level++) {
+    /* Each level is in queueing order: just look at the heads */
+    while ((t = curcpu->c_runqueue[level].tl_head.tln_next->tln_self)
+           != NULL &&
+           curcpu->c_hardclocks - t->t_readysince >= SCHED_AGE_HARDCLOCKS) {
+      threadlist_remhead(&curcpu->c_runqueue[level]);
+      t->t_priority = level - 1;
+      t->t_ticks = 0;
+      runqueue_add(curcpu, t);
+      curcpu->c_agings++;
+    }
+  }
+  spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+void
+thread_tick(void)
+{
+  struct thread *cur = curthread;
+  bool yield = false;
+  unsigned i;
+
+  if (curcpu->c_isidle) {
+    /* Nobody is running; curthread is asleep */
+    return;
+  }
+
+  spinlock_acquire(&curcpu->c_runqueue_lock);
+  if (++cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+    /* Used up its slice */
+    if (cur->t_priority < SCHED_NLEVELS - 1) {
+      cur->t_priority++;
+      curcpu->c_demotions++;
+    }
+    cur->t_ticks = 0;
+    yield = true;
+  }   else {
+    /* Preempt it if something more important is ready */
+    for (i = 0; i < cur->t_priority; i++) {
+      if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+        yield = true;
+        break;
+      }
+    }
+  }
+  spinlock_release(&curcpu->c_runqueue_lock);
+
+  if (yield) {
+    thread_yield();
+  }
+}
+
+void
+thread_printsched(void)
+{
+  unsigned i, j, numcpus;
+  struct cpu *c;
+
+  kprintf("cpu");
+  for (j = 0; j < SCHED_NLEVELS; j++) {
+    kprintf("   q%u", j);
+  }
+  kprintf("  demoted  boosted     aged   stolen\n");
+
+  numcpus = cpuarray_num(&allcpus);
+  for (i = 0; i < numcpus; i++) {
+    c = cpuarray_get(&allcpus, i);
+    spinlock_acquire(&c->c_runqueue_lock);
+    kprintf("%3u", c->c_number);
+    for (j = 0; j < SCHED_NLEVELS; j++) {
+      kprintf(" %4u", c->c_runqueue[j].tl_count);
+    }
+    kprintf(" %8lu %8lu %8lu %8lu\n", c->c_demotions, c->c_boosts,
+      c->c_agings, c->c_steals);
+    spinlock_release(&c->c_runqueue_lock);
+  }
 }
 
 /*
@@ -857,9 +1253,9 @@ thread_consider_migration(void)
   for (i = 0; i < numcpus; i++) {
     c = cpuarray_get(&allcpus, i);
     spinlock_acquire(&c->c_runqueue_lock);
-    total_count += c->c_runqueue.tl_count;
+    total_count += runqueue_count(c);
     if (c == curcpu->c_self) {
-      my_count = c->c_runqueue.tl_count;
+      my_count = runqueue_count(c);
     }
     spinlock_release(&c->c_runqueue_lock);
   }
@@ -873,7 +1269,8 @@ thread_consider_migration(void)
   threadlist_init(&victims);
   spinlock_acquire(&curcpu->c_runqueue_lock);
   for (i = 0; i < to_send; i++) {
-    t = threadlist_remtail(&curcpu->c_runqueue);
+    /* The threads that would run last, so mostly hogs */
+    t = runqueue_remtail(curcpu);
     threadlist_addhead(&victims, t);
   }
   spinlock_release(&curcpu->c_runqueue_lock);
@@ -884,7 +1281,7 @@ thread_consider_migration(void)
       continue;
     }
     spinlock_acquire(&c->c_runqueue_lock);
-    while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+    while (runqueue_count(c) < one_share && to_send > 0) {
       t = threadlist_remhead(&victims);
       /*
        * Ordinarily, curthread will not appear on
@@ -915,7 +1312,7 @@ thread_consider_migration(void)
       }
 
       t->t_cpu = c;
-      threadlist_addtail(&c->c_runqueue, t);
+      runqueue_add(c, t);
       DEBUG(DB_THREADS,
         "Migrated thread %s: cpu %u -> %u",
         t->t_name, curcpu->c_number, c->c_number);
@@ -939,7 +1336,7 @@ thread_consider_migration(void)
   if (!threadlist_isempty(&victims)) {
     spinlock_acquire(&curcpu->c_runqueue_lock);
     while ((t = threadlist_remhead(&victims)) != NULL) {
-      threadlist_addtail(&curcpu->c_runqueue, t);
+      runqueue_add(curcpu, t);
     }
     spinlock_release(&curcpu->c_runqueue_lock);
   }
@@ -1126,36 +1523,96 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Send a batch of N TLB shootdown requests to the specified CPU with
+ * one IPI. Requests that don't fit in the queue turn into a full
+ * flush of the target's TLB. Returns the sequence number of the batch.
  */
-void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+uint32_t
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mappings,
+  unsigned n)
 {
-  unsigned n;
+  unsigned i, queued;
+  uint32_t seq;
 
   spinlock_acquire(&target->c_ipi_lock);
 
-  n = target->c_numshootdown;
-  if (n == TLBSHOOTDOWN_MAX) {
-    /*
-     * If you have problems with this panic going off,
-     * consider: (1) increasing the maximum, (2) putting
-     * logic here to sleep until space appears (may
-     * interact awkwardly with VM system locking), (3)
-     * putting logic here to coalesce requests together,
-     * and/or (4) improving VM system state tracking to
-     * reduce the number of unnecessary shootdowns.
-     */
-    panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+  queued = target->c_numshootdown;
+  if (target->c_shootdownall || queued + n > TLBSHOOTDOWN_MAX) {
+    target->c_shootdownall = true;
+    target->c_numshootdown = 0;
   }   else {
-    target->c_shootdown[n] = *mapping;
-    target->c_numshootdown = n + 1;
+    for (i = 0; i < n; i++) {
+      target->c_shootdown[queued + i] = mappings[i];
+    }
+    target->c_numshootdown = queued + n;
   }
+  seq = ++target->c_shootdown_seq;
 
   target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
   mainbus_send_ipi(target);
 
   spinlock_release(&target->c_ipi_lock);
+
+  return seq;
+}
+
+/*
+ * Wait until the target CPU has handled shootdown batch SEQ.
+ * Shootdowns are handled in the interrupt handler right away, so
+ * this just spins.
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target, uint32_t seq)
+{
+  uint32_t done;
+
+  KASSERT(curthread->t_curspl == 0);
+
+  do {
+    spinlock_acquire(&target->c_ipi_lock);
+    done = target->c_shootdown_done;
+    spinlock_release(&target->c_ipi_lock);
+  } while ((int32_t)(done - seq) < 0);
+}
+
+/*
+ * Carry out a batch of N TLB shootdown requests on every CPU: on this
+ * one directly, on the others with an IPI each. Then wait until they
+ * have all handled it.
+ */
+void
+ipi_tlbshootdown_allcpus(const struct tlbshootdown *mappings, unsigned n)
+{
+  uint32_t seqs[MAXCPUS];
+  struct cpu *self;
+  unsigned i, numcpus;
+  int spl;
+
+  numcpus = cpuarray_num(&allcpus);
+  KASSERT(numcpus <= MAXCPUS);
+
+  /* Stay on this cpu until the others have been sent theirs */
+  spl = splhigh();
+  self = curcpu->c_self;
+  for (i = 0; i < numcpus; i++) {
+    if (cpuarray_get(&allcpus, i) != self) {
+      seqs[i] = ipi_tlbshootdown(cpuarray_get(&allcpus, i), mappings, n);
+    }
+  }
+  if (n > TLBSHOOTDOWN_MAX) {
+    vm_tlbshootdown_all();
+  }   else {
+    for (i = 0; i < n; i++) {
+      vm_tlbshootdown(&mappings[i]);
+    }
+  }
+  splx(spl);
+
+  for (i = 0; i < numcpus; i++) {
+    if (cpuarray_get(&allcpus, i) != self) {
+      ipi_tlbshootdown_wait(cpuarray_get(&allcpus, i), seqs[i]);
+    }
+  }
 }
 
 /*
@@ -1199,10 +1656,16 @@ interprocessor_interrupt(void)
      * need to release the ipi lock while calling
      * vm_tlbshootdown.
      */
-    for (i = 0; i < curcpu->c_numshootdown; i++) {
-      vm_tlbshootdown(&curcpu->c_shootdown[i]);
+    if (curcpu->c_shootdownall) {
+      vm_tlbshootdown_all();
+    }   else {
+      for (i = 0; i < curcpu->c_numshootdown; i++) {
+        vm_tlbshootdown(&curcpu->c_shootdown[i]);
+      }
     }
     curcpu->c_numshootdown = 0;
+    curcpu->c_shootdownall = false;
+    curcpu->c_shootdown_done = curcpu->c_shootdown_seq;
   }
 
   curcpu->c_ipi_pending = 0;
@@ -25,7 +25,8 @@
 
 
 static cirarray system_openTable;
-static struct lock *sys_openTable_lk;
+/* lookups (every read, write, lseek...) only read the table */
+static struct rwlock *sys_openTable_lk;
 
 void openfileIncrRefCount(fcb file)
 {
@@ -53,6 +54,8 @@ void sys_fileTable_bootstrap(void)
 {
   CAoperations ops;
 
+  FCB_bootstrap();
+
   ops.newItem = newFCB;
   ops.cmpItem = cmpFCB;
   ops.freeItem = freeFCB;
@@ -61,7 +64,10 @@ void sys_fileTable_bootstrap(void)
   ops.coutItem = coutFCB;
 
   system_openTable = CA_create(OPEN_MAX * 100, ops);
-  sys_openTable_lk = lock_create("sysOpenTable_lk");
+  sys_openTable_lk = rwlock_create("sysOpenTable_lk");
+  if (sys_openTable_lk == NULL) {
+    panic("sys_fileTable_bootstrap: rwlock_create failed\n");
+  }
 }
 
 int sys_fileTable_add(fcb file)
@@ -71,9 +77,9 @@ int sys_fileTable_add(fcb file)
   if (file == NULL)
     return 0;
 
-  lock_acquire(sys_openTable_lk);
+  rwlock_acquire_write(sys_openTable_lk);
   result = CA_add(system_openTable, file);
-  lock_release(sys_openTable_lk);
+  rwlock_release_write(sys_openTable_lk);
 
   return result;
 }
@@ -82,16 +88,20 @@ int sys_fileTable_remove(int ind)
 {
   int result;
 
-  lock_acquire(sys_openTable_lk);
+  rwlock_acquire_write(sys_openTable_lk);
   result = CA_remove_byIndex(system_openTable, ind);
-  lock_release(sys_openTable_lk);
+  rwlock_release_write(sys_openTable_lk);
 
   return result;
 }
 
 fcb sys_fileTable_get(int ind)
 {
-  fcb file = CA_get_byIndex(system_openTable, ind);
+  fcb file;
+
+  rwlock_acquire_read(sys_openTable_lk);
+  file = CA_get_byIndex(system_openTable, ind);
+  rwlock_release_read(sys_openTable_lk);
 
   return file;
 }
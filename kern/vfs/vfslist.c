@@ -90,6 +90,15 @@ DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Changes to knowndevs, and to the kd_fs of its entries, are made
+ * holding both vfs_biglock and knowndevs_lock for writing. So holding
+ * either of them is enough to look at the list; knowndevs_lock, for
+ * reading, lets lookups that need nothing else go on in parallel.
+ * Take vfs_biglock first if you need both.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -106,6 +115,11 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create knowndevs array\n");
 	}
 
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
+
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
 		panic("vfs: Could not create vfs big lock\n");
@@ -278,11 +292,11 @@ vfs_getdevname(struct fs *fs)
 {
 	struct knowndev *kd;
 	unsigned i, num;
+	const char *name = NULL;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
+	rwlock_acquire_read(knowndevs_lock);
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -294,11 +308,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rwlock_release_read(knowndevs_lock);
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -443,7 +459,9 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		goto fail;
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
 	result = knowndevarray_add(knowndevs, kd, &index);
+	rwlock_release_write(knowndevs_lock);
 	if (result) {
 		goto fail;
 	}
@@ -499,7 +517,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock.
  */
 static
 int
@@ -567,7 +585,9 @@ vfs_mount(const char *devname, void *data,
 	KASSERT(fs != NULL);
 	KASSERT(fs != SWAP_FS); 
 
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = fs;
+	rwlock_release_write(knowndevs_lock);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -617,7 +637,9 @@ vfs_swapon(const char *devname, struct vnode **ret)
 
 	kprintf("vfs: Swap attached to %s\n", kd->kd_name);
 
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = SWAP_FS;
+	rwlock_release_write(knowndevs_lock);
 	VOP_INCREF(kd->kd_vnode);
 	*ret = kd->kd_vnode;
 
@@ -668,7 +690,9 @@ vfs_unmount(const char *devname)
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	/* now drop the filesystem */
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_lock);
 
 	KASSERT(result==0);
 
@@ -705,7 +729,9 @@ vfs_swapoff(const char *devname)
 	kprintf("vfs: Swap detached from %s:\n", kd->kd_name);
 
 	/* drop it */
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_lock);
 
 	KASSERT(result==0);
 
@@ -739,7 +765,9 @@ vfs_unmountall(void)
 		}
 		if (dev->kd_fs == SWAP_FS) {
 			/* just drop it */
+			rwlock_acquire_write(knowndevs_lock);
 			dev->kd_fs = NULL;
+			rwlock_release_write(knowndevs_lock);
 			continue;
 		}
 
@@ -777,7 +805,9 @@ vfs_unmountall(void)
 		}
 
 		/* now drop the filesystem */
+		rwlock_acquire_write(knowndevs_lock);
 		dev->kd_fs = NULL;
+		rwlock_release_write(knowndevs_lock);
 	}
 
 	vfs_biglock_release();
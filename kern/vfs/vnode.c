@@ -37,6 +37,10 @@
 #include <vfs.h>
 #include <vnode.h>
 
+/* Source of vn_id */
+static struct spinlock vnode_idlock = SPINLOCK_INITIALIZER;
+static unsigned vnode_nextid;
+
 /*
  * Initialize an abstract vnode.
  */
@@ -52,6 +56,11 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+
+	spinlock_acquire(&vnode_idlock);
+	vn->vn_id = vnode_nextid++;
+	spinlock_release(&vnode_idlock);
+	vn->vn_version = 0;
 	return 0;
 }
 
@@ -122,6 +131,63 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Note that the contents of the file changed. This is done after the
+ * change, so that whoever read the version before reading the file
+ * sees a different one if the change overlapped the read.
+ */
+static
+void
+vnode_changed(struct vnode *vn)
+{
+	spinlock_acquire(&vn->vn_countlock);
+	vn->vn_version++;
+	spinlock_release(&vn->vn_countlock);
+}
+
+/*
+ * Write, and note the change.
+ * Called by VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	/* Even a failed write may have changed part of the file */
+	vnode_changed(vn);
+	return result;
+}
+
+/*
+ * Truncate, and note the change.
+ * Called by VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t len)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, len);
+	vnode_changed(vn);
+	return result;
+}
+
+/*
+ * Return the current version of the contents of the file.
+ */
+unsigned
+vnode_getversion(struct vnode *vn)
+{
+	unsigned version;
+
+	spinlock_acquire(&vn->vn_countlock);
+	version = vn->vn_version;
+	spinlock_release(&vn->vn_countlock);
+	return version;
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
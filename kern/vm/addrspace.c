@@ -33,12 +33,447 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <pagecache.h>
+#include <swap.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vmstats.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
+ *
+ * An address space is a handful of regions (the ELF segments and the
+ * stack) plus a two-level page table. Defining a region only records
+ * its bounds; frames are allocated and zeroed by as_fault_page() when
+ * vm_fault() finds a page touched for the first time. So the cost of
+ * exec and the memory footprint of a process scale with the pages it
+ * actually uses, not with the declared size of its segments.
+ */
+
+/*
+ * Set up an empty region.
+ */
+static
+void
+region_init(struct region *rg, vaddr_t vaddr, size_t npages, int flags)
+{
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = npages;
+	rg->rg_flags = flags;
+	rg->rg_vnode = NULL;
+	rg->rg_foffset = 0;
+	rg->rg_fvaddr = 0;
+	rg->rg_filesz = 0;
+}
+
+/*
+ * Check if any of the page at VADDR in RG comes from a file.
+ */
+static
+bool
+region_hasfile(struct region *rg, vaddr_t vaddr)
+{
+	return rg->rg_vnode != NULL &&
+		vaddr < rg->rg_fvaddr + rg->rg_filesz &&
+		vaddr + PAGE_SIZE > rg->rg_fvaddr;
+}
+
+/*
+ * Fill the frame PADDR with the contents of the page at VADDR in a
+ * region: the part backed by the file is read from it, the rest is
+ * zero-filled. Part of a file mapping that is now past the end of the
+ * file, which was truncated, is zero-filled too.
+ */
+static
+int
+region_readpage(struct region *rg, vaddr_t vaddr, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio u;
+	vaddr_t start, end;
+	char *kva;
+	int result;
+
+	kva = (char *)PADDR_TO_KVADDR(paddr);
+
+	start = end = vaddr;
+	if (rg->rg_vnode != NULL) {
+		start = rg->rg_fvaddr > vaddr ? rg->rg_fvaddr : vaddr;
+		end = rg->rg_fvaddr + rg->rg_filesz;
+		if (end > vaddr + PAGE_SIZE) {
+			end = vaddr + PAGE_SIZE;
+		}
+		if (start >= end) {
+			start = end = vaddr;
+		}
+	}
+
+	bzero(kva, start - vaddr);
+	bzero(kva + (end - vaddr), PAGE_SIZE - (end - vaddr));
+	if (start == end) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &u, kva + (start - vaddr), end - start,
+		  rg->rg_foffset + (start - rg->rg_fvaddr), UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		/* short read: the file shrank after it was mapped */
+		if (rg->rg_flags & RG_TEXT) {
+			/* a truncated executable can't be run */
+			kprintf("vm: short read on file page\n");
+			return EIO;
+		}
+		/* for a file mapping, what is past the new end reads as zero */
+		bzero(kva + (end - vaddr) - u.uio_resid, u.uio_resid);
+	}
+
+	vmstats_inc(VMS_FILE_READS);
+	return 0;
+}
+
+/*
+ * Check if the page at VADDR in RG can be shared through the page
+ * cache: it must be part of a read-only executable segment (other
+ * file mappings are left out, so that one-off mmaps of data files
+ * don't fill the cache) and start within the file contents.
+ */
+static
+bool
+region_cacheable(struct region *rg, vaddr_t vaddr)
+{
+	return rg->rg_vnode != NULL &&
+		(rg->rg_flags & (RG_TEXT | RG_W | RG_SHARED)) == RG_TEXT &&
+		vaddr >= rg->rg_fvaddr &&
+		vaddr < rg->rg_fvaddr + rg->rg_filesz;
+}
+
+/*
+ * Get the frame for a cacheable page: from the page cache if it's
+ * there, else read it and add it. *SHARED is set if the frame is
+ * shared through the cache.
  */
+static
+int
+region_sharedpage(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+		  paddr_t *ret, bool *shared)
+{
+	paddr_t paddr;
+	off_t offset;
+	size_t len;
+	unsigned version;
+	int result;
+
+	offset = rg->rg_foffset + (vaddr - rg->rg_fvaddr);
+	len = rg->rg_fvaddr + rg->rg_filesz - vaddr;
+	if (len > PAGE_SIZE) {
+		len = PAGE_SIZE;
+	}
+
+	paddr = pagecache_lookup(rg->rg_vnode, offset, len);
+	if (paddr != 0) {
+		*shared = true;
+		*ret = paddr;
+		return 0;
+	}
+
+	paddr = swap_getframe(as, false);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	/* Taken before the read, so a write meanwhile keeps it private */
+	version = vnode_getversion(rg->rg_vnode);
+	result = region_readpage(rg, vaddr, paddr);
+	if (result) {
+		coremap_free(paddr);
+		return result;
+	}
+
+	*ret = pagecache_insert(rg->rg_vnode, version, offset, len,
+				paddr, shared);
+	return 0;
+}
+
+static
+bool
+region_contains(const struct region *rg, vaddr_t vaddr)
+{
+	return vaddr >= rg->rg_vbase &&
+		vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+}
+
+/*
+ * Return the region containing VADDR, or NULL.
+ */
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned i;
+
+	for (i = 0; i < as->as_nsegs; i++) {
+		if (region_contains(&as->as_segs[i], vaddr)) {
+			return &as->as_segs[i];
+		}
+	}
+
+	if (region_contains(&as->as_stack, vaddr)) {
+		return &as->as_stack;
+	}
+
+	if (region_contains(&as->as_heap, vaddr)) {
+		return &as->as_heap;
+	}
+
+	for (i = 0; i < AS_MAXMAPS; i++) {
+		if (region_contains(&as->as_maps[i], vaddr)) {
+			return &as->as_maps[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Check if the stack may grow down to VADDR: not past its maximum
+ * size, and not into the guard gap above the heap.
+ */
+static
+bool
+as_stack_growable(struct addrspace *as, vaddr_t vaddr)
+{
+	vaddr_t heapend;
+
+	heapend = (as->as_heaptop + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	return as->as_stack.rg_npages > 0 &&
+		vaddr < as->as_stack.rg_vbase &&
+		vaddr >= USERSTACK - VM_STACKMAX * PAGE_SIZE &&
+		vaddr >= heapend + VM_STACKGUARD * PAGE_SIZE;
+}
+
+/*
+ * Extend the stack region down to the page of VADDR. Nothing is
+ * allocated: the new pages get frames when touched, like all others.
+ * Must be called with as_lock held.
+ */
+struct region *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack = &as->as_stack;
+	vaddr_t base;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	if (!as_stack_growable(as, vaddr)) {
+		return NULL;
+	}
+
+	base = vaddr & PAGE_FRAME;
+	stack->rg_npages += (stack->rg_vbase - base) / PAGE_SIZE;
+	stack->rg_vbase = base;
+	vmstats_inc(VMS_STACK_GROWS);
+
+	return stack;
+}
+
+/*
+ * Check if pages of a region can be mapped writeable. Read-only
+ * segments must still be writeable while load_elf fills them.
+ */
+bool
+as_region_writeable(struct addrspace *as, struct region *rg)
+{
+	return (rg->rg_flags & RG_W) || as->as_loading;
+}
+
+/*
+ * Get the page at VADDR (in region RG) ready to be mapped and return
+ * its page table entry in RET. On first touch the page is allocated
+ * and zero-filled, and a page in swap is read back. If WRITE is set,
+ * a page shared copy-on-write with other address spaces gets a
+ * private copy of its frame (unless this is the last reference to
+ * it), and a page of a shared file mapping is marked dirty. A
+ * copy-on-write page whose other sharers are all gone is taken back
+ * on any fault. Must be called with as_lock held. Returns an error
+ * code on error.
+ */
+int
+as_fault_page(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	      bool write, pte_t *ret)
+{
+	pte_t *pte, bits;
+	paddr_t paddr, old;
+	bool shared, zero;
+	int result;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT(region_contains(rg, vaddr));
+
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	if (!(*pte & PTE_VALID)) {
+		/* Shared file pages start read-only, to catch writes */
+		bits = ((rg->rg_flags & (RG_W | RG_SHARED)) == RG_W) ?
+			PTE_WRITE : 0;
+		if (*pte & PTE_SWAPPED) {
+			bits = *pte & (PTE_WRITE | PTE_DIRTY);
+		}
+		shared = false;
+		/* (while loading, read-only pages are mapped writeable) */
+		if (!(*pte & PTE_SWAPPED) && !as->as_loading &&
+		    region_cacheable(rg, vaddr)) {
+			result = region_sharedpage(as, rg, vaddr, &paddr,
+						   &shared);
+			if (result) {
+				return result;
+			}
+		}
+		else {
+			/* Anonymous pages come zeroed from the frame pool */
+			zero = !(*pte & PTE_SWAPPED) &&
+				!region_hasfile(rg, vaddr);
+			paddr = swap_getframe(as, zero);
+			if (paddr == 0) {
+				return ENOMEM;
+			}
+			if (*pte & PTE_SWAPPED) {
+				result = swap_pagein(PTE_SLOT(*pte), paddr);
+			}
+			else if (zero) {
+				result = 0;
+			}
+			else {
+				result = region_readpage(rg, vaddr, paddr);
+			}
+			if (result) {
+				coremap_free(paddr);
+				return result;
+			}
+		}
+		*pte = paddr | PTE_VALID | bits;
+		if (!shared) {
+			coremap_setowner(paddr, as, vaddr);
+		}
+	}
+
+	/*
+	 * A shared frame has no owner, so the pager leaves it alone. When
+	 * the other sharers unmap it nothing tells us, and it stays pinned
+	 * until a fault here sees it is ours alone and owns it again.
+	 */
+	if ((*pte & PTE_COW) &&
+	    (write || coremap_refcount(*pte & PTE_FRAME) == 1)) {
+		old = *pte & PTE_FRAME;
+		if (coremap_refcount(old) > 1) {
+			paddr = swap_getframe(as, false);
+			if (paddr == 0) {
+				return ENOMEM;
+			}
+			memmove((void *)PADDR_TO_KVADDR(paddr),
+				(const void *)PADDR_TO_KVADDR(old),
+				PAGE_SIZE);
+			*pte = (*pte & ~PTE_FRAME) | paddr;
+			coremap_free(old);
+		}
+		/* The frame is ours alone now, and can be paged out */
+		*pte &= ~PTE_COW;
+		coremap_setowner(*pte & PTE_FRAME, as, vaddr);
+	}
+
+	if (write && !(*pte & PTE_WRITE) && (rg->rg_flags & RG_W)) {
+		/* First write to a shared file page since written back */
+		*pte |= PTE_WRITE |
+			((rg->rg_flags & RG_SHARED) ? PTE_DIRTY : 0);
+	}
+
+	*ret = *pte;
+	return 0;
+}
+
+/*
+ * Write the modified pages among the NPAGES from VADDR of the shared
+ * file mapping RG back to the file. Only the part of the mapping that
+ * was within the file is written: mappings don't extend files. The
+ * pages are write-protected again, so further writes are noticed.
+ * Must be called with as_lock held.
+ */
+static
+int
+as_writeback(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	     size_t npages)
+{
+	struct iovec iov;
+	struct uio u;
+	struct tlbbatch tb;
+	vaddr_t va;
+	pte_t *pte, dummy;
+	size_t i, len;
+	bool wrote = false;
+	int result = 0;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT(rg->rg_flags & RG_SHARED);
+
+	vm_tlbbatch_init(&tb, as);
+
+	for (i = 0; i < npages; i++) {
+		va = vaddr + i * PAGE_SIZE;
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || !(*pte & PTE_DIRTY)) {
+			continue;
+		}
+		if (!(*pte & PTE_VALID)) {
+			/* Paged out since it was written; read it back */
+			result = as_fault_page(as, rg, va, false, &dummy);
+			if (result) {
+				break;
+			}
+		}
+
+		if (va < rg->rg_fvaddr + rg->rg_filesz) {
+			len = rg->rg_fvaddr + rg->rg_filesz - va;
+			if (len > PAGE_SIZE) {
+				len = PAGE_SIZE;
+			}
+			uio_kinit(&iov, &u,
+				  (void *)PADDR_TO_KVADDR(*pte & PTE_FRAME),
+				  len, rg->rg_foffset + (va - rg->rg_fvaddr),
+				  UIO_WRITE);
+			result = VOP_WRITE(rg->rg_vnode, &u);
+			wrote = true;
+			if (result == 0 && u.uio_resid != 0) {
+				result = EIO;
+			}
+			if (result) {
+				break;
+			}
+			vmstats_inc(VMS_FILE_WRITES);
+		}
+
+		*pte &= ~(PTE_DIRTY | PTE_WRITE);
+		vm_tlbbatch_add(&tb, va);
+	}
+
+	/* Drop the writeable translations */
+	vm_tlbbatch_flush(&tb);
+
+	/* Cached copies of what we wrote over are stale; free them now */
+	if (wrote) {
+		pagecache_invalidate(rg->rg_vnode);
+	}
+	return result;
+}
 
 struct addrspace *
 as_create(void)
@@ -50,28 +485,77 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	/* No regions yet */
+	bzero(as, sizeof(struct addrspace));
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
 
 	return as;
 }
 
+/*
+ * Copy an address space. Pages are not copied but shared
+ * copy-on-write: both address spaces reference the same frames until
+ * one of them writes to a page (see as_fault_page).
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	unsigned i;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
+	for (i = 0; i < old->as_nsegs; i++) {
+		newas->as_segs[i] = old->as_segs[i];
+		if (newas->as_segs[i].rg_vnode != NULL) {
+			VOP_INCREF(newas->as_segs[i].rg_vnode);
+		}
+	}
+	newas->as_nsegs = old->as_nsegs;
+	newas->as_stack = old->as_stack;
+	newas->as_heap = old->as_heap;
+	newas->as_heaptop = old->as_heaptop;
+	for (i = 0; i < AS_MAXMAPS; i++) {
+		newas->as_maps[i] = old->as_maps[i];
+		/* The child gets a private copy of shared mappings */
+		newas->as_maps[i].rg_flags &= ~RG_SHARED;
+		if (newas->as_maps[i].rg_vnode != NULL) {
+			VOP_INCREF(newas->as_maps[i].rg_vnode);
+		}
+	}
+	newas->as_loading = old->as_loading;
+
+	/* Keep the pager off the old pages while they get shared */
+	lock_acquire(old->as_lock);
+	result = pt_copy(old->as_pt, newas->as_pt);
+	lock_release(old->as_lock);
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
+
 	/*
-	 * Write this.
+	 * The pages are now shared copy-on-write, so the TLB must not
+	 * keep writeable translations for them: drop them, and the
+	 * next faults will load read-only ones.
 	 */
-
-	(void)old;
+	vm_tlb_invalidate(old);
 
 	*ret = newas;
 	return 0;
@@ -80,10 +564,32 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	unsigned i;
+
+	/* Wait for the pager to be done with our pages */
+	lock_acquire(as->as_lock);
+	for (i = 0; i < AS_MAXMAPS; i++) {
+		if (as->as_maps[i].rg_flags & RG_SHARED) {
+			/* Too late to report errors */
+			as_writeback(as, &as->as_maps[i], as->as_maps[i].rg_vbase,
+				     as->as_maps[i].rg_npages);
+		}
+	}
+	pt_destroy(as->as_pt);
+	lock_release(as->as_lock);
 
+	for (i = 0; i < as->as_nsegs; i++) {
+		if (as->as_segs[i].rg_vnode != NULL) {
+			VOP_DECREF(as->as_segs[i].rg_vnode);
+		}
+	}
+	for (i = 0; i < AS_MAXMAPS; i++) {
+		if (as->as_maps[i].rg_vnode != NULL) {
+			VOP_DECREF(as->as_maps[i].rg_vnode);
+		}
+	}
+
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -101,19 +607,14 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	/* The TLB keeps our translations, tagged with our ASID */
+	vm_tlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
-	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
-	 */
+	/* nothing */
 }
 
 /*
@@ -122,57 +623,121 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Only
+ * the write permission is enforced, as the MIPS TLB can't tell reads
+ * from instruction fetches.
+ *
+ * No memory is allocated here: pages are zero-filled on first touch.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	size_t npages;
+	int flags;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = memsize / PAGE_SIZE;
+
+	flags = (readable ? RG_R : 0) | (writeable ? RG_W : 0) |
+		(executable ? RG_X : 0);
+
+	/* Pages are filled in by the kernel, so check it's user memory */
+	if (vaddr + memsize < vaddr || vaddr + memsize > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	if (as->as_nsegs == AS_MAXSEGS) {
+		kprintf("vm: Warning: too many regions\n");
+		return ENOSYS;
+	}
+
+	region_init(&as->as_segs[as->as_nsegs++], vaddr, npages, flags);
+	return 0;
 }
 
+/*
+ * Back the segment at VADDR (defined already) with the file V: its
+ * first FILESIZE bytes come from offset OFFSET in the file, the rest
+ * up to MEMSIZE are zero. Nothing is read now; as_fault_page reads
+ * each page on first touch, so exec doesn't pay for pages the program
+ * never uses.
+ */
 int
-as_prepare_load(struct addrspace *as)
+as_define_file(struct addrspace *as, struct vnode *v, off_t offset,
+	       vaddr_t vaddr, size_t memsize, size_t filesize)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL || rg->rg_vnode != NULL) {
+		return EINVAL;
+	}
+	if (filesize == 0) {
+		return 0;
+	}
+
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_foffset = offset;
+	rg->rg_fvaddr = vaddr;
+	rg->rg_filesz = filesize;
+	rg->rg_flags |= RG_TEXT;
+
+	return 0;
+}
 
-	(void)as;
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Let load_elf write into read-only segments */
+	as->as_loading = true;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	vaddr_t heapbase = 0;
+	unsigned i;
+
+	as->as_loading = false;
+
+	/* The heap starts out empty after the last segment */
+	for (i = 0; i < as->as_nsegs; i++) {
+		rg = &as->as_segs[i];
+		if (rg->rg_vbase + rg->rg_npages * PAGE_SIZE > heapbase) {
+			heapbase = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		}
+	}
+	region_init(&as->as_heap, heapbase, 0, RG_R | RG_W);
+	as->as_heaptop = heapbase;
+
+	/* Drop the writeable mappings of read-only segments */
+	vm_tlb_invalidate(as);
 
-	(void)as;
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	KASSERT(as->as_stack.rg_npages == 0);
 
-	(void)as;
+	region_init(&as->as_stack, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+		    VM_STACKPAGES, RG_R | RG_W);
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +745,294 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Throw away the NPAGES pages from VADDR on: their frames are freed
+ * and their swap slots released. Must be called with as_lock held.
+ */
+static
+void
+as_release_pages(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct tlbbatch tb;
+	pte_t *pte;
+	size_t i;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	/* Unmap the pages first... */
+	vm_tlbbatch_init(&tb, as);
+	for (i = 0; i < npages; i++) {
+		pte = pt_lookup(as->as_pt, vaddr + i * PAGE_SIZE, false);
+		if (pte == NULL) {
+			continue;
+		}
+		if (*pte & PTE_SWAPPED) {
+			swap_release(PTE_SLOT(*pte));
+			*pte = 0;
+		}
+		if (*pte & PTE_VALID) {
+			*pte &= ~PTE_VALID;
+			vm_tlbbatch_add(&tb, vaddr + i * PAGE_SIZE);
+		}
+	}
+
+	/* ...then drop their translations... */
+	vm_tlbbatch_flush(&tb);
+
+	/* ...and only then let the frames go */
+	for (i = 0; i < npages; i++) {
+		pte = pt_lookup(as->as_pt, vaddr + i * PAGE_SIZE, false);
+		if (pte == NULL) {
+			continue;
+		}
+		if (*pte & PTE_FRAME) {
+			coremap_free(*pte & PTE_FRAME);
+		}
+		*pte = 0;
+	}
+}
+
+/*
+ * Return the lowest address above the heap that is in use: the
+ * lowest mapping, or the stack.
+ */
+static
+vaddr_t
+as_heap_limit(struct addrspace *as)
+{
+	vaddr_t limit = as->as_stack.rg_vbase;
+	unsigned i;
+
+	for (i = 0; i < AS_MAXMAPS; i++) {
+		if (as->as_maps[i].rg_npages > 0 &&
+		    as->as_maps[i].rg_vbase < limit) {
+			limit = as->as_maps[i].rg_vbase;
+		}
+	}
+	return limit;
+}
+
+/*
+ * sbrk: move the break by AMOUNT, which may be negative. The heap
+ * can grow up to the guard gap below the stack and the mappings;
+ * growing just moves the break, the pages are allocated by vm_fault.
+ * Shrinking frees the pages past the new break right away.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap = &as->as_heap;
+	vaddr_t old, new;
+	size_t npages;
+
+	lock_acquire(as->as_lock);
+
+	old = as->as_heaptop;
+	new = old + amount;
+	if (amount < 0 && (new > old || new < heap->rg_vbase)) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	if (amount > 0 && (new < old ||
+	    new > as_heap_limit(as) - VM_STACKGUARD * PAGE_SIZE)) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	npages = (((new + PAGE_SIZE - 1) & PAGE_FRAME) - heap->rg_vbase) /
+		PAGE_SIZE;
+	if (npages < heap->rg_npages) {
+		as_release_pages(as, heap->rg_vbase + npages * PAGE_SIZE,
+				 heap->rg_npages - npages);
+	}
+	heap->rg_npages = npages;
+	as->as_heaptop = new;
+
+	lock_release(as->as_lock);
+
+	*oldbreak = old;
+	return 0;
+}
+
+/*
+ * Map LEN bytes (see as_mmap in addrspace.h). The address is picked
+ * top-down from VM_MMAPTOP, below the room kept for the stack, in the
+ * highest gap between the other mappings that is big enough; the
+ * guard gap is kept above the heap.
+ */
+int
+as_mmap(struct addrspace *as, size_t len, int flags, struct vnode *v,
+	off_t offset, size_t filesz, vaddr_t *ret)
+{
+	struct region *rg, *slot = NULL;
+	vaddr_t base, heapend;
+	size_t npages;
+	unsigned i;
+	bool moved;
+
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (npages == 0 || npages > VM_MMAPTOP / PAGE_SIZE) {
+		return EINVAL;
+	}
+
+	lock_acquire(as->as_lock);
+
+	for (i = 0; i < AS_MAXMAPS; i++) {
+		if (as->as_maps[i].rg_npages == 0) {
+			slot = &as->as_maps[i];
+			break;
+		}
+	}
+	if (slot == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	/* Move down below any mapping in the way until none is */
+	base = VM_MMAPTOP - npages * PAGE_SIZE;
+	do {
+		moved = false;
+		for (i = 0; i < AS_MAXMAPS; i++) {
+			rg = &as->as_maps[i];
+			if (rg->rg_npages > 0 &&
+			    base < rg->rg_vbase + rg->rg_npages * PAGE_SIZE &&
+			    base + npages * PAGE_SIZE > rg->rg_vbase) {
+				if (rg->rg_vbase < npages * PAGE_SIZE) {
+					lock_release(as->as_lock);
+					return ENOMEM;
+				}
+				base = rg->rg_vbase - npages * PAGE_SIZE;
+				moved = true;
+			}
+		}
+	} while (moved);
+
+	heapend = (as->as_heaptop + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (base < heapend + VM_STACKGUARD * PAGE_SIZE) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	region_init(slot, base, npages, flags);
+	if (v != NULL) {
+		VOP_INCREF(v);
+		slot->rg_vnode = v;
+		slot->rg_foffset = offset;
+		slot->rg_fvaddr = base;
+		slot->rg_filesz = filesz < len ? filesz : len;
+	}
+
+	lock_release(as->as_lock);
+
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Return the mapping that overlaps the NPAGES pages from VADDR, or
+ * NULL.
+ */
+static
+struct region *
+as_find_map(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct region *rg;
+	unsigned i;
+
+	for (i = 0; i < AS_MAXMAPS; i++) {
+		rg = &as->as_maps[i];
+		if (rg->rg_npages > 0 &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE &&
+		    vaddr + npages * PAGE_SIZE > rg->rg_vbase) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Unmap a whole mapping; splitting mappings is not supported.
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	size_t npages;
+	int result = 0;
+
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || npages == 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(as->as_lock);
+
+	rg = as_find_map(as, vaddr, npages);
+	if (rg == NULL || rg->rg_vbase != vaddr || rg->rg_npages != npages) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	if (rg->rg_flags & RG_SHARED) {
+		/* The mapping goes away regardless */
+		result = as_writeback(as, rg, rg->rg_vbase, rg->rg_npages);
+	}
+	as_release_pages(as, rg->rg_vbase, rg->rg_npages);
+	if (rg->rg_vnode != NULL) {
+		VOP_DECREF(rg->rg_vnode);
+	}
+	region_init(rg, 0, 0, 0);
+
+	lock_release(as->as_lock);
+
+	return result;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t start, end;
+	unsigned i;
+	bool found = false;
+	int result = 0;
+
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0) {
+		return EINVAL;
+	}
+	end = (vaddr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (end < vaddr) {
+		return ENOMEM;
+	}
+
+	lock_acquire(as->as_lock);
+
+	for (i = 0; i < AS_MAXMAPS && result == 0; i++) {
+		rg = &as->as_maps[i];
+		if (rg->rg_npages == 0 || vaddr >= rg->rg_vbase +
+		    rg->rg_npages * PAGE_SIZE || end <= rg->rg_vbase) {
+			continue;
+		}
+		found = true;
+		if (!(rg->rg_flags & RG_SHARED)) {
+			continue;
+		}
+		start = vaddr > rg->rg_vbase ? vaddr : rg->rg_vbase;
+		if (end < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			result = as_writeback(as, rg, start,
+					      (end - start) / PAGE_SIZE);
+		}
+		else {
+			result = as_writeback(as, rg, start,
+				rg->rg_npages - (start - rg->rg_vbase) / PAGE_SIZE);
+		}
+	}
+
+	lock_release(as->as_lock);
+
+	if (result == 0 && !found) {
+		/* Nothing mapped there */
+		result = ENOMEM;
+	}
+	return result;
+}
@@ -0,0 +1,888 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <wchan.h>
+#include <vm.h>
+#include <coremap.h>
+#include <platform/maxcpus.h>
+
+/*
+ * Buddy allocator for physical page frames.
+ *
+ * Frame indexes are relative to the first managed frame (cm_base), so
+ * the buddy of the block starting at index i with order k is simply
+ * i ^ (1 << k). Every frame has an entry in the coremap array:
+ * - the first frame of a free block is flagged as free and records
+ *   the order of the block and its links in the free list;
+ * - the first frame of an allocation records its size in pages, so
+ *   that coremap_free() doesn't need to be told how much to release.
+ *
+ * Requests that are not a power of two are carved from the block of
+ * the next order up, and the unused tail is handed back immediately.
+ *
+ * Single frames, which are by far the most common request (thread
+ * stacks, kmalloc pages, page faults), are served by a small per-cpu
+ * cache ("magazine") protected by its own spinlock. The magazine is
+ * refilled from and drained to the buddy lists PCP_BATCH frames at a
+ * time, so coremap_lock is taken once per batch instead of once per
+ * frame. Frames sitting in a magazine are allocated as far as the
+ * buddy lists are concerned (cme_npages == 1).
+ *
+ * Single frames also carry a reference count, so that user pages can
+ * be shared between address spaces (copy-on-write fork): coremap_free
+ * drops one reference and only releases the frame with the last one.
+ *
+ * Frames backing user pages that belong to a single address space
+ * record their owner, so that the pager can evict them. The pager
+ * scans the coremap with a clock hand, giving a second chance to the
+ * frames referenced since its last pass, and marks the victim busy
+ * while it writes it out; freeing a busy frame waits for the pager.
+ */
+
+#define CM_NONE (-1)
+
+struct coremap_entry {
+  int cme_next;              /* next free block of the same order */
+  int cme_prev;              /* previous free block of the same order */
+  unsigned cme_npages;       /* pages allocated starting here (0 if none) */
+  unsigned cme_refcount;     /* references to an allocated single frame */
+  struct addrspace *cme_as;  /* owner of an evictable user page, or NULL */
+  vaddr_t cme_vaddr;         /* user address of the page */
+  unsigned char cme_order;   /* order of the free block starting here */
+  unsigned char cme_free;    /* true if a free block starts here */
+  unsigned char cme_ref;     /* referenced since the last clock pass */
+  unsigned char cme_busy;    /* being paged out */
+};
+
+static struct coremap_entry *coremap = NULL;
+static unsigned long cm_base = 0;      /* frame number of index 0 */
+static unsigned long cm_nframes = 0;   /* number of managed frames */
+static unsigned long cm_nfree = 0;     /* number of free frames */
+
+/* free list heads and number of free blocks, for each order */
+static int cm_freelist[COREMAP_MAXORDER + 1];
+static unsigned long cm_nblocks[COREMAP_MAXORDER + 1];
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct wchan *coremap_wchan;    /* waiting for busy frames */
+static unsigned long cm_hand = 0;      /* clock hand for the pager */
+
+static bool coremap_active = false;
+
+/* Per-cpu magazine size, and number of frames moved per refill/drain */
+#define PCP_HIGH  16
+#define PCP_BATCH 8
+
+struct pcp_cache {
+  struct spinlock pcp_lock;
+  unsigned pcp_count;              /* frames currently cached */
+  paddr_t pcp_frames[PCP_HIGH];
+  unsigned long pcp_hits;          /* allocs served without coremap_lock */
+  unsigned long pcp_refills;       /* batches taken from the buddy lists */
+  unsigned long pcp_drains;        /* batches given back to the buddy lists */
+};
+
+static struct pcp_cache pcp[MAXCPUS];
+
+/*
+ * Pool of pre-zeroed single frames, refilled by idle cpus up to
+ * ZERO_HIGH frames as long as more than ZERO_MINFREE frames are free.
+ * Frames in the pool are allocated (one reference, no owner) but
+ * count as free, and are given back when memory is tight.
+ */
+#define ZERO_HIGH    32
+#define ZERO_MINFREE 64
+
+static struct spinlock zero_lock = SPINLOCK_INITIALIZER;
+static paddr_t zero_frames[ZERO_HIGH];
+static unsigned zero_count = 0;
+static unsigned long zero_hits = 0;    /* allocs served from the pool */
+static unsigned long zero_misses = 0;  /* allocs that had to zero */
+static unsigned long zero_filled = 0;  /* frames zeroed by idle cpus */
+
+////////////////////////////////////////////////////////////
+// internal functions
+
+/*
+ * Smallest order whose blocks hold npages frames.
+ */
+static unsigned order_of(unsigned long npages)
+{
+  unsigned order = 0;
+
+  while ((1UL << order) < npages) {
+    order++;
+  }
+
+  return order;
+}
+
+static void freelist_insert(int idx, unsigned order)
+{
+  struct coremap_entry *e = &coremap[idx];
+
+  e->cme_free = 1;
+  e->cme_order = order;
+  e->cme_prev = CM_NONE;
+  e->cme_next = cm_freelist[order];
+  if (cm_freelist[order] != CM_NONE) {
+    coremap[cm_freelist[order]].cme_prev = idx;
+  }
+  cm_freelist[order] = idx;
+  cm_nblocks[order]++;
+}
+
+static void freelist_remove(int idx)
+{
+  struct coremap_entry *e = &coremap[idx];
+
+  KASSERT(e->cme_free);
+
+  if (e->cme_prev != CM_NONE) {
+    coremap[e->cme_prev].cme_next = e->cme_next;
+  } else {
+    cm_freelist[e->cme_order] = e->cme_next;
+  }
+  if (e->cme_next != CM_NONE) {
+    coremap[e->cme_next].cme_prev = e->cme_prev;
+  }
+  cm_nblocks[e->cme_order]--;
+  e->cme_free = 0;
+  e->cme_next = e->cme_prev = CM_NONE;
+}
+
+/*
+ * Put a block back on the free lists, merging it with its buddy for
+ * as long as the buddy is a free block of the same order.
+ */
+static void free_block(unsigned long idx, unsigned order)
+{
+  unsigned long buddy;
+
+  while (order < COREMAP_MAXORDER) {
+    buddy = idx ^ (1UL << order);
+    if (buddy + (1UL << order) > cm_nframes ||
+        !coremap[buddy].cme_free || coremap[buddy].cme_order != order) {
+      break;
+    }
+    freelist_remove(buddy);
+    if (buddy < idx) {
+      idx = buddy;
+    }
+    order++;
+  }
+
+  freelist_insert(idx, order);
+}
+
+/*
+ * Free an arbitrary run of frames, splitting it into the largest
+ * naturally aligned blocks it contains.
+ */
+static void free_range(unsigned long idx, unsigned long npages)
+{
+  unsigned order;
+
+  while (npages > 0) {
+    order = 0;
+    while (order < COREMAP_MAXORDER &&
+           (idx & ((2UL << order) - 1)) == 0 &&
+           (2UL << order) <= npages) {
+      order++;
+    }
+    free_block(idx, order);
+    idx += 1UL << order;
+    npages -= 1UL << order;
+  }
+}
+
+/*
+ * Allocate npages frames from the buddy lists.
+ * Must be called with coremap_lock held. Return the index of the
+ * first frame, or CM_NONE if there is no free block large enough.
+ */
+static int buddy_alloc(unsigned long npages)
+{
+  unsigned order, k;
+  int idx;
+
+  order = order_of(npages);
+  if (order > COREMAP_MAXORDER) {
+    return CM_NONE;
+  }
+
+  /* Looking for the smallest non-empty free list that fits */
+  for (k = order; k <= COREMAP_MAXORDER && cm_freelist[k] == CM_NONE; k++);
+  if (k > COREMAP_MAXORDER) {
+    return CM_NONE;
+  }
+
+  idx = cm_freelist[k];
+  freelist_remove(idx);
+
+  /* Split down to the requested order, freeing the upper halves */
+  while (k > order) {
+    k--;
+    freelist_insert(idx + (1 << k), k);
+  }
+
+  /* Give back the unused tail of the block */
+  if (npages < (1UL << order)) {
+    free_range(idx + npages, (1UL << order) - npages);
+  }
+
+  coremap[idx].cme_npages = npages;
+  coremap[idx].cme_refcount = 1;
+  cm_nfree -= npages;
+
+  return idx;
+}
+
+/*
+ * Give back to the buddy lists an allocation starting at idx.
+ * Must be called with coremap_lock held.
+ */
+static void buddy_free(unsigned long idx)
+{
+  unsigned long npages;
+
+  KASSERT(idx < cm_nframes);
+
+  npages = coremap[idx].cme_npages;
+  KASSERT(npages > 0);
+  coremap[idx].cme_npages = 0;
+
+  free_range(idx, npages);
+  cm_nfree += npages;
+}
+
+static paddr_t idx_to_paddr(unsigned long idx)
+{
+  return (paddr_t)(cm_base + idx) * PAGE_SIZE;
+}
+
+static unsigned long paddr_to_idx(paddr_t paddr)
+{
+  return paddr / PAGE_SIZE - cm_base;
+}
+
+/*
+ * Return the magazine of the current cpu. If we get preempted and
+ * migrated after this, we just end up using another cpu's magazine,
+ * which is slower but still correct as each one has its own lock.
+ */
+static struct pcp_cache *pcp_get(void)
+{
+  if (!CURCPU_EXISTS()) {
+    return &pcp[0];
+  }
+  return &pcp[curcpu->c_number];
+}
+
+/*
+ * Move up to PCP_BATCH single frames from the buddy lists into the
+ * magazine. Must be called with the magazine lock held.
+ */
+static void pcp_refill(struct pcp_cache *pc)
+{
+  int idx;
+
+  spinlock_acquire(&coremap_lock);
+  while (pc->pcp_count < PCP_BATCH) {
+    idx = buddy_alloc(1);
+    if (idx == CM_NONE) {
+      break;
+    }
+    pc->pcp_frames[pc->pcp_count++] = idx_to_paddr(idx);
+  }
+  spinlock_release(&coremap_lock);
+
+  pc->pcp_refills++;
+}
+
+/*
+ * Move up to n frames from the magazine back to the buddy lists.
+ * Must be called with the magazine lock held.
+ */
+static void pcp_drain(struct pcp_cache *pc, unsigned n)
+{
+  if (pc->pcp_count == 0) {
+    return;
+  }
+
+  spinlock_acquire(&coremap_lock);
+  while (n > 0 && pc->pcp_count > 0) {
+    buddy_free(paddr_to_idx(pc->pcp_frames[--pc->pcp_count]));
+    n--;
+  }
+  spinlock_release(&coremap_lock);
+
+  pc->pcp_drains++;
+}
+
+/*
+ * Allocate a single frame, going through the magazine.
+ */
+static paddr_t pcp_alloc(void)
+{
+  struct pcp_cache *pc = pcp_get();
+  paddr_t paddr = 0;
+
+  spinlock_acquire(&pc->pcp_lock);
+  if (pc->pcp_count > 0) {
+    pc->pcp_hits++;
+  } else {
+    pcp_refill(pc);
+  }
+  if (pc->pcp_count > 0) {
+    paddr = pc->pcp_frames[--pc->pcp_count];
+    coremap[paddr_to_idx(paddr)].cme_refcount = 1;
+  }
+  spinlock_release(&pc->pcp_lock);
+
+  return paddr;
+}
+
+/*
+ * Free a single frame, going through the magazine.
+ */
+static void pcp_free(paddr_t paddr)
+{
+  struct pcp_cache *pc = pcp_get();
+
+  spinlock_acquire(&pc->pcp_lock);
+  if (pc->pcp_count == PCP_HIGH) {
+    pcp_drain(pc, PCP_BATCH);
+  }
+  pc->pcp_frames[pc->pcp_count++] = paddr;
+  spinlock_release(&pc->pcp_lock);
+}
+
+/*
+ * Give every frame in the zeroed pool back to the buddy lists.
+ */
+static void zero_drain(void)
+{
+  paddr_t frames[ZERO_HIGH];
+  unsigned i, n;
+
+  spinlock_acquire(&zero_lock);
+  n = zero_count;
+  for (i = 0; i < n; i++) {
+    frames[i] = zero_frames[i];
+  }
+  zero_count = 0;
+  spinlock_release(&zero_lock);
+
+  spinlock_acquire(&coremap_lock);
+  for (i = 0; i < n; i++) {
+    coremap[paddr_to_idx(frames[i])].cme_refcount = 0;
+    buddy_free(paddr_to_idx(frames[i]));
+  }
+  spinlock_release(&coremap_lock);
+}
+
+////////////////////////////////////////////////////////////
+// external interface
+
+/*
+ * Take over physical memory management from ram.c.
+ * The coremap itself is placed in stolen memory, then everything
+ * past it is handed to the buddy free lists.
+ */
+void coremap_bootstrap(void)
+{
+  unsigned long i, ntotal, cmpages;
+  paddr_t cmpaddr, firstpaddr;
+
+  KASSERT(!coremap_active);
+
+  /* Size the coremap on the whole RAM; the first frames are wasted. */
+  ntotal = ram_getsize() / PAGE_SIZE;
+  cmpages = DIVROUNDUP(ntotal * sizeof(struct coremap_entry), PAGE_SIZE);
+  cmpaddr = ram_stealmem(cmpages);
+  if (cmpaddr == 0) {
+    panic("coremap: cannot allocate %lu pages for the coremap\n", cmpages);
+  }
+  coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+  /* From now on ram_stealmem() doesn't work anymore */
+  firstpaddr = ram_getfirstfree();
+  cm_base = firstpaddr / PAGE_SIZE;
+  cm_nframes = ntotal - cm_base;
+
+  for (i = 0; i <= COREMAP_MAXORDER; i++) {
+    cm_freelist[i] = CM_NONE;
+    cm_nblocks[i] = 0;
+  }
+
+  for (i = 0; i < MAXCPUS; i++) {
+    spinlock_init(&pcp[i].pcp_lock);
+    pcp[i].pcp_count = 0;
+    pcp[i].pcp_hits = 0;
+    pcp[i].pcp_refills = 0;
+    pcp[i].pcp_drains = 0;
+  }
+
+  for (i = 0; i < cm_nframes; i++) {
+    coremap[i].cme_next = CM_NONE;
+    coremap[i].cme_prev = CM_NONE;
+    coremap[i].cme_npages = 0;
+    coremap[i].cme_refcount = 0;
+    coremap[i].cme_as = NULL;
+    coremap[i].cme_vaddr = 0;
+    coremap[i].cme_ref = 0;
+    coremap[i].cme_busy = 0;
+    coremap[i].cme_order = 0;
+    coremap[i].cme_free = 0;
+  }
+
+  spinlock_acquire(&coremap_lock);
+  free_range(0, cm_nframes);
+  cm_nfree = cm_nframes;
+  coremap_active = true;
+  spinlock_release(&coremap_lock);
+
+  /* Needs kmalloc, so only now */
+  coremap_wchan = wchan_create("coremap");
+  if (coremap_wchan == NULL) {
+    panic("coremap: cannot create wchan\n");
+  }
+}
+
+/*
+ * Check if the coremap has been bootstrapped.
+ * coremap_active is set once at boot and never cleared afterwards,
+ * so there's no need to take coremap_lock to read it.
+ */
+bool coremap_isactive(void)
+{
+  return coremap_active;
+}
+
+/*
+ * Allocate npages physically contiguous frames.
+ * Return the physical address of the first one, or 0 if there is no
+ * free block large enough (or the coremap is not active yet).
+ *
+ * If the buddy lists can't satisfy the request, the per-cpu magazines
+ * are drained (so that their frames can coalesce), kmalloc gives back
+ * the pages its own caches keep in use, and we try again.
+ */
+paddr_t coremap_alloc(unsigned long npages)
+{
+  paddr_t paddr;
+  int idx;
+
+  KASSERT(npages > 0);
+
+  if (!coremap_isactive()) {
+    return 0;
+  }
+
+  if (npages == 1) {
+    paddr = pcp_alloc();
+    if (paddr != 0) {
+      return paddr;
+    }
+  } else {
+    spinlock_acquire(&coremap_lock);
+    idx = buddy_alloc(npages);
+    spinlock_release(&coremap_lock);
+    if (idx != CM_NONE) {
+      return idx_to_paddr(idx);
+    }
+  }
+
+  /* Low on memory: flush the heap's and our magazines and retry */
+  kmalloc_drain();
+  coremap_drain();
+
+  spinlock_acquire(&coremap_lock);
+  idx = buddy_alloc(npages);
+  spinlock_release(&coremap_lock);
+
+  return idx == CM_NONE ? 0 : idx_to_paddr(idx);
+}
+
+/*
+ * Allocate a single zero-filled frame, from the pool if possible.
+ */
+paddr_t coremap_alloc_zeroed(void)
+{
+  paddr_t paddr = 0;
+
+  spinlock_acquire(&zero_lock);
+  if (zero_count > 0) {
+    paddr = zero_frames[--zero_count];
+    zero_hits++;
+  } else {
+    zero_misses++;
+  }
+  spinlock_release(&zero_lock);
+
+  if (paddr != 0) {
+    return paddr;
+  }
+
+  paddr = coremap_alloc(1);
+  if (paddr != 0) {
+    bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+  }
+  return paddr;
+}
+
+/*
+ * Zero one frame for the pool, if it needs one and memory isn't
+ * tight. Called by idle cpus with interrupts off, so one frame at a
+ * time: the caller lets interrupts in and checks for work in between.
+ * Return true if a frame was zeroed.
+ */
+bool coremap_idle_zero(void)
+{
+  paddr_t paddr;
+
+  /* Unlocked peeks: at worst we zero one frame too many */
+  if (!coremap_isactive() || zero_count >= ZERO_HIGH ||
+      cm_nfree < ZERO_MINFREE) {
+    return false;
+  }
+
+  /* Not coremap_alloc: don't drain the magazines for this */
+  paddr = pcp_alloc();
+  if (paddr == 0) {
+    return false;
+  }
+  bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+
+  spinlock_acquire(&zero_lock);
+  if (zero_count < ZERO_HIGH) {
+    zero_frames[zero_count++] = paddr;
+    zero_filled++;
+    paddr = 0;
+  }
+  spinlock_release(&zero_lock);
+
+  if (paddr != 0) {
+    /* Another cpu filled the pool meanwhile */
+    coremap_free(paddr);
+  }
+  return true;
+}
+
+/*
+ * Free frames previously obtained from coremap_alloc.
+ * Frames below the managed range were stolen before the coremap was
+ * bootstrapped and can't be reclaimed, so they are silently ignored.
+ */
+void coremap_free(paddr_t paddr)
+{
+  unsigned long pfn, idx;
+
+  KASSERT((paddr & PAGE_FRAME) == paddr);
+
+  pfn = paddr / PAGE_SIZE;
+
+  if (!coremap_isactive() || pfn < cm_base) {
+    return;
+  }
+
+  idx = pfn - cm_base;
+  KASSERT(idx < cm_nframes);
+
+  /*
+   * The pager may pick an evictable user page at any time: wait until
+   * it is done with the frame, and make sure it isn't picked again.
+   * Only the owner sets cme_as, so if it reads NULL here the pager
+   * can't be looking at the frame.
+   */
+  if (coremap[idx].cme_as != NULL || coremap[idx].cme_busy) {
+    spinlock_acquire(&coremap_lock);
+    while (coremap[idx].cme_busy) {
+      wchan_sleep(coremap_wchan, &coremap_lock);
+    }
+    coremap[idx].cme_as = NULL;
+    spinlock_release(&coremap_lock);
+  }
+
+  /*
+   * Drop one reference to a shared frame. A reference count of 1 can't
+   * go up behind our back (only a holder of a reference may add one),
+   * so the lock is only needed when the frame is actually shared.
+   */
+  if (coremap[idx].cme_refcount > 1) {
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[idx].cme_refcount > 0);
+    if (--coremap[idx].cme_refcount > 0) {
+      spinlock_release(&coremap_lock);
+      return;
+    }
+    spinlock_release(&coremap_lock);
+  } else {
+    coremap[idx].cme_refcount = 0;
+  }
+
+  /*
+   * cme_npages of an allocated block only changes when its owner
+   * frees it, so it's safe to look at it without coremap_lock.
+   */
+  if (coremap[idx].cme_npages == 1) {
+    pcp_free(paddr);
+    return;
+  }
+
+  spinlock_acquire(&coremap_lock);
+  buddy_free(idx);
+  spinlock_release(&coremap_lock);
+}
+
+/*
+ * Add a reference to a single frame, so that it is shared by one more
+ * owner. Each reference is dropped with coremap_free.
+ */
+void coremap_incref(paddr_t paddr)
+{
+  unsigned long idx;
+
+  KASSERT(coremap_isactive());
+  idx = paddr_to_idx(paddr);
+  KASSERT(idx < cm_nframes);
+  KASSERT(coremap[idx].cme_npages == 1);
+
+  spinlock_acquire(&coremap_lock);
+  KASSERT(coremap[idx].cme_refcount > 0);
+  coremap[idx].cme_refcount++;
+  /*
+   * Shared frames have no single owner and can't be evicted. Nothing
+   * gives the frame an owner back when the sharing ends; it stays
+   * pinned until the last holder faults on it (see as_fault_page).
+   */
+  coremap[idx].cme_as = NULL;
+  spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of references to a single frame.
+ */
+unsigned coremap_refcount(paddr_t paddr)
+{
+  unsigned long idx;
+  unsigned refcount;
+
+  KASSERT(coremap_isactive());
+  idx = paddr_to_idx(paddr);
+  KASSERT(idx < cm_nframes);
+
+  spinlock_acquire(&coremap_lock);
+  refcount = coremap[idx].cme_refcount;
+  spinlock_release(&coremap_lock);
+
+  return refcount;
+}
+
+/*
+ * Record that a single frame backs the user page at VADDR in AS, which
+ * makes it a candidate for eviction (AS == NULL makes it unevictable).
+ * Must be called by the only holder of the frame.
+ */
+void coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+  unsigned long idx;
+
+  KASSERT(coremap_isactive());
+  idx = paddr_to_idx(paddr);
+  KASSERT(idx < cm_nframes);
+  KASSERT(coremap[idx].cme_npages == 1);
+
+  spinlock_acquire(&coremap_lock);
+  KASSERT(as == NULL || coremap[idx].cme_refcount == 1);
+  coremap[idx].cme_as = as;
+  coremap[idx].cme_vaddr = vaddr;
+  coremap[idx].cme_ref = 1;
+  spinlock_release(&coremap_lock);
+}
+
+/*
+ * Note that a frame was just referenced. This is only a hint for the
+ * clock, so no lock is taken.
+ */
+void coremap_touch(paddr_t paddr)
+{
+  unsigned long idx;
+
+  idx = paddr_to_idx(paddr);
+  if (paddr / PAGE_SIZE >= cm_base && idx < cm_nframes) {
+    coremap[idx].cme_ref = 1;
+  }
+}
+
+/*
+ * Pick a user page to evict with the clock algorithm: frames
+ * referenced since the last pass lose their reference bit and get a
+ * second chance. The victim is marked busy and its frame returned,
+ * with its owner and user address in AS and VADDR; 0 is returned if
+ * there is nothing to evict.
+ *
+ * The MIPS TLB has no reference bits, so a frame is only counted as
+ * referenced when a translation for it is loaded: pages that stay in
+ * the TLB for long may look idle. With 64 TLB entries this is a small
+ * fraction of memory.
+ */
+paddr_t coremap_victim(struct addrspace **as, vaddr_t *vaddr)
+{
+  struct coremap_entry *e;
+  unsigned long n, idx;
+  paddr_t paddr = 0;
+
+  KASSERT(coremap_isactive());
+
+  spinlock_acquire(&coremap_lock);
+  /* Two passes: the first may only clear reference bits */
+  for (n = 0; n < 2 * cm_nframes; n++) {
+    idx = cm_hand;
+    cm_hand = (cm_hand + 1) % cm_nframes;
+
+    e = &coremap[idx];
+    if (e->cme_as == NULL || e->cme_busy || e->cme_refcount != 1) {
+      continue;
+    }
+    if (e->cme_ref) {
+      e->cme_ref = 0;
+      continue;
+    }
+
+    e->cme_busy = 1;
+    *as = e->cme_as;
+    *vaddr = e->cme_vaddr;
+    paddr = idx_to_paddr(idx);
+    break;
+  }
+  spinlock_release(&coremap_lock);
+
+  return paddr;
+}
+
+/*
+ * Clear the busy mark set by coremap_victim.
+ */
+void coremap_unbusy(paddr_t paddr)
+{
+  unsigned long idx;
+
+  idx = paddr_to_idx(paddr);
+  KASSERT(idx < cm_nframes);
+
+  spinlock_acquire(&coremap_lock);
+  KASSERT(coremap[idx].cme_busy);
+  coremap[idx].cme_busy = 0;
+  wchan_wakeall(coremap_wchan, &coremap_lock);
+  spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of free frames in the buddy lists and the zeroed
+ * pool, without any locking. Frames cached per cpu are not counted, so this may be a
+ * little low, and it may be stale: use it for heuristics only.
+ */
+unsigned long coremap_freeestimate(void)
+{
+  return cm_nfree + zero_count;
+}
+
+/*
+ * Give back to the buddy lists every frame cached in the per-cpu
+ * magazines and the zeroed pool. Called when memory is tight.
+ */
+void coremap_drain(void)
+{
+  unsigned i;
+
+  zero_drain();
+
+  for (i = 0; i < MAXCPUS; i++) {
+    spinlock_acquire(&pcp[i].pcp_lock);
+    pcp_drain(&pcp[i], PCP_HIGH);
+    spinlock_release(&pcp[i].pcp_lock);
+  }
+}
+
+/*
+ * Return the current number of free frames.
+ */
+unsigned long coremap_freepages(void)
+{
+  unsigned long nfree;
+  unsigned i;
+
+  spinlock_acquire(&coremap_lock);
+  nfree = cm_nfree;
+  spinlock_release(&coremap_lock);
+
+  /* Frames in the magazines and in the zeroed pool are free too */
+  for (i = 0; i < MAXCPUS; i++) {
+    spinlock_acquire(&pcp[i].pcp_lock);
+    nfree += pcp[i].pcp_count;
+    spinlock_release(&pcp[i].pcp_lock);
+  }
+  spinlock_acquire(&zero_lock);
+  nfree += zero_count;
+  spinlock_release(&zero_lock);
+
+  return nfree;
+}
+
+/*
+ * Print per-order free block counts.
+ */
+void coremap_printstats(void)
+{
+  unsigned long hits, refills, drains;
+  unsigned long nblocks[COREMAP_MAXORDER + 1];
+  unsigned long nframes, nfree;
+  unsigned i, ncached;
+
+  /* Take a snapshot, so as not to print while holding the spinlock */
+  spinlock_acquire(&coremap_lock);
+  for (i = 0; i <= COREMAP_MAXORDER; i++) {
+    nblocks[i] = cm_nblocks[i];
+  }
+  nframes = cm_nframes;
+  nfree = cm_nfree;
+  spinlock_release(&coremap_lock);
+
+  kprintf("Coremap: %lu frames managed, %lu free (%luk)\n",
+    nframes, nfree, nfree * PAGE_SIZE / 1024);
+  kprintf("  order  pages  free blocks\n");
+  for (i = 0; i <= COREMAP_MAXORDER; i++) {
+    kprintf("  %5u  %5lu  %11lu\n", i, 1UL << i, nblocks[i]);
+  }
+
+  kprintf("Per-cpu frame magazines:\n");
+  kprintf("  cpu  cached        hits     refills      drains\n");
+  for (i = 0; i < MAXCPUS; i++) {
+    spinlock_acquire(&pcp[i].pcp_lock);
+    ncached = pcp[i].pcp_count;
+    hits = pcp[i].pcp_hits;
+    refills = pcp[i].pcp_refills;
+    drains = pcp[i].pcp_drains;
+    spinlock_release(&pcp[i].pcp_lock);
+    if (hits == 0 && refills == 0 && drains == 0) {
+      /* never used: cpu not present */
+      continue;
+    }
+    kprintf("  %3u  %6u  %10lu  %10lu  %10lu\n", i, ncached,
+      hits, refills, drains);
+  }
+
+  spinlock_acquire(&zero_lock);
+  ncached = zero_count;
+  hits = zero_hits;
+  drains = zero_misses;
+  refills = zero_filled;
+  spinlock_release(&zero_lock);
+  kprintf("Zeroed frame pool: %u/%u frames\n", ncached, ZERO_HIGH);
+  kprintf("  %lu hits, %lu misses, %lu frames zeroed by idle cpus\n",
+    hits, drains, refills);
+}
@@ -29,8 +29,13 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
 
 /*
  * Kernel malloc.
@@ -102,6 +107,12 @@ fill_deadbeef(void *vptr, size_t len)
  * LABELS records the allocation site and a generation number for each
  * allocation and is useful for tracking down memory leaks.
  *
+ * PROFILE records the allocation site, size, and generation of every
+ * live allocation (subpage or not) in a table on the side, and counts
+ * allocations per site, for kheap_profile(). Unlike LABELS it doesn't
+ * change the heap layout, and it finds leaks by site rather than by
+ * block; it does put a lock on every kmalloc and kfree, though.
+ *
  * On top of these one can enable the following:
  *
  * CHECKBEEF checks that free blocks still contain 0xdeadbeef when
@@ -117,6 +128,7 @@ fill_deadbeef(void *vptr, size_t len)
 #undef SLOWER
 #undef GUARDS
 #undef LABELS
+#undef PROFILE
 
 #undef CHECKBEEF
 #undef CHECKGUARDS
@@ -160,10 +172,8 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the page lists. Most allocations and frees
+ * don't get that far, though: see the per-cpu magazines below.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -345,6 +355,79 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * The block type of each physical page plus one, or 0 for pages that
+ * aren't subpage heap pages. This tells kfree the size of a block
+ * without kmalloc_spinlock. It is set up along with the first heap
+ * page, early in boot when ram_getsize() still works, and never freed.
+ * Entries only change under kmalloc_spinlock, while the page has no
+ * allocated blocks.
+ */
+static uint8_t *kheap_pagetypes;
+static unsigned long kheap_npages;
+
+static
+void
+kheap_pagetypes_init(void)
+{
+	unsigned long npages;
+	vaddr_t va;
+
+	npages = ram_getsize() / PAGE_SIZE;
+	KASSERT(npages > 0);
+
+	va = alloc_kpages(DIVROUNDUP(npages, PAGE_SIZE));
+	if (va == 0) {
+		panic("kmalloc: Couldn't get the heap page table\n");
+	}
+	bzero((void *)va, npages);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	if (kheap_pagetypes == NULL) {
+		kheap_npages = npages;
+		kheap_pagetypes = (uint8_t *)va;
+		va = 0;
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	if (va != 0) {
+		/* Somebody else got there first */
+		free_kpages(va);
+	}
+}
+
+/*
+ * Return the block type of the heap page ADDR is on, or -1 if it isn't
+ * on a subpage heap page.
+ */
+static
+int
+kheap_pagetype(vaddr_t addr)
+{
+	unsigned long page;
+
+	if (addr < MIPS_KSEG0 || addr >= MIPS_KSEG1 ||
+	    kheap_pagetypes == NULL) {
+		return -1;
+	}
+	page = (addr - MIPS_KSEG0) / PAGE_SIZE;
+	if (page >= kheap_npages) {
+		return -1;
+	}
+	return (int)kheap_pagetypes[page] - 1;
+}
+
+static
+void
+kheap_setpagetype(vaddr_t prpage, int blktype)
+{
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(prpage >= MIPS_KSEG0);
+	KASSERT((prpage - MIPS_KSEG0) / PAGE_SIZE < kheap_npages);
+
+	kheap_pagetypes[(prpage - MIPS_KSEG0) / PAGE_SIZE] = blktype + 1;
+}
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -697,225 +780,922 @@ dump_subpages(unsigned generation)
 
 #endif /* LABELS */
 
-void
-kheap_nextgeneration(void)
-{
-#ifdef LABELS
-	spinlock_acquire(&kmalloc_spinlock);
-	mallocgeneration++;
-	spinlock_release(&kmalloc_spinlock);
-#endif
-}
+////////////////////////////////////////
 
-void
-kheap_dump(void)
-{
-#ifdef LABELS
-	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
-	dump_subpages(mallocgeneration);
-	spinlock_release(&kmalloc_spinlock);
-#else
-	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
-#endif
-}
+#ifdef PROFILE
 
-void
-kheap_dumpall(void)
-{
-#ifdef LABELS
-	unsigned i;
+/*
+ * Allocation-site profiling.
+ *
+ * Each live allocation has an entry in a hash table keyed by address,
+ * which holds its size, generation, and site. The sites are kept in a
+ * table of their own with counts of what they have live and what they
+ * have allocated, both in total and in the current generation. Sites
+ * that don't fit in the site table are lumped together in slot 0;
+ * allocations that don't fit in the live table aren't tracked at all
+ * (and are counted in kp_untracked).
+ *
+ * Everything is in one struct, which is allocated from the page
+ * allocator the first time kmalloc is called. Entries are linked by
+ * 16-bit index, with 0 as the null index.
+ */
 
-	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
-	for (i=0; i<=mallocgeneration; i++) {
-		dump_subpages(i);
-	}
-	spinlock_release(&kmalloc_spinlock);
-#else
-	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
-#endif
-}
+#define PROF_MAXLIVE	8192		/* live allocations tracked */
+#define PROF_NBUCKETS	2048		/* buckets for them; power of 2 */
+#define PROF_MAXSITES	512		/* sites tracked; power of 2 */
+#define PROF_TOP	10		/* sites kheap_profile prints */
+
+struct kprof_live {
+	vaddr_t kl_ptr;
+	uint32_t kl_size;
+	uint16_t kl_site;		/* index into kp_sites */
+	uint16_t kl_generation;		/* (low bits of) profgeneration */
+	uint16_t kl_next;		/* on bucket chain or free list */
+};
 
-////////////////////////////////////////
+struct kprof_site {
+	vaddr_t ks_site;		/* caller of kmalloc; 0 for "other" */
+	unsigned ks_live;		/* live allocations */
+	unsigned long ks_bytes;		/* bytes in them */
+	unsigned long ks_allocs;	/* allocations ever */
+	unsigned ks_genlive;		/* same, this generation */
+	unsigned long ks_genbytes;
+	unsigned long ks_genallocs;
+};
+
+struct kprof {
+	uint16_t kp_buckets[PROF_NBUCKETS];
+	uint16_t kp_freelive;
+	unsigned kp_nsites;
+	unsigned long kp_untracked;
+	struct kprof_live kp_live[PROF_MAXLIVE];
+	struct kprof_site kp_sites[PROF_MAXSITES];
+};
+
+static struct spinlock kprof_spinlock = SPINLOCK_INITIALIZER;
+static struct kprof *kprof;
+static bool kprof_busy;		/* kprof is being allocated */
+static unsigned profgeneration;
+
+#define PROF_PTRHASH(ptr) ((((ptr) >> 4) ^ ((ptr) >> 14)) & (PROF_NBUCKETS-1))
+#define PROF_SITEHASH(site) ((((site) >> 2) ^ ((site) >> 11)) & (PROF_MAXSITES-1))
 
 /*
- * Print the allocated/freed map of a single kernel heap page.
+ * Set up the table. Returns false if that's not possible right now.
  */
 static
-void
-subpage_stats(struct pageref *pr)
+bool
+kprof_init(void)
 {
-	vaddr_t prpage, fla;
-	struct freelist *fl;
-	int blktype;
-	unsigned i, n, index;
-	uint32_t freemap[PAGE_SIZE / (SMALLEST_SUBPAGE_SIZE*32)];
-
-	checksubpage(pr);
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	struct kprof *kp;
+	unsigned i;
 
-	/* clear freemap[] */
-	for (i=0; i<ARRAYCOUNT(freemap); i++) {
-		freemap[i] = 0;
+	spinlock_acquire(&kprof_spinlock);
+	if (kprof_busy) {
+		/* alloc_kpages called kmalloc, or another cpu is at it */
+		spinlock_release(&kprof_spinlock);
+		return false;
+	}
+	kprof_busy = true;
+	spinlock_release(&kprof_spinlock);
+
+	kp = (struct kprof *)alloc_kpages(DIVROUNDUP(sizeof(*kp), PAGE_SIZE));
+	if (kp == NULL) {
+		spinlock_acquire(&kprof_spinlock);
+		kprof_busy = false;
+		spinlock_release(&kprof_spinlock);
+		return false;
 	}
 
-	prpage = PR_PAGEADDR(pr);
-	blktype = PR_BLOCKTYPE(pr);
-	KASSERT(blktype >= 0 && blktype < NSIZES);
+	bzero(kp, sizeof(*kp));
+	for (i=1; i<PROF_MAXLIVE; i++) {
+		kp->kp_live[i].kl_next = i+1 < PROF_MAXLIVE ? i+1 : 0;
+	}
+	kp->kp_freelive = 1;
+	/* slot 0 is "other" */
+	kp->kp_nsites = 1;
+
+	spinlock_acquire(&kprof_spinlock);
+	kprof = kp;
+	spinlock_release(&kprof_spinlock);
+	return true;
+}
 
-	/* compute how many bits we need in freemap and assert we fit */
-	n = PAGE_SIZE / sizes[blktype];
-	KASSERT(n <= 32 * ARRAYCOUNT(freemap));
+/*
+ * Find (or add) SITE in the site table.
+ */
+static
+unsigned
+kprof_getsite(vaddr_t site)
+{
+	unsigned i;
 
-	if (pr->freelist_offset != INVALID_OFFSET) {
-		fla = prpage + pr->freelist_offset;
-		fl = (struct freelist *)fla;
+	KASSERT(spinlock_do_i_hold(&kprof_spinlock));
 
-		for (; fl != NULL; fl = fl->next) {
-			fla = (vaddr_t)fl;
-			index = (fla-prpage) / sizes[blktype];
-			KASSERT(index<n);
-			freemap[index/32] |= (1<<(index%32));
+	i = PROF_SITEHASH(site);
+	while (true) {
+		if (i != 0) {
+			if (kprof->kp_sites[i].ks_site == site) {
+				return i;
+			}
+			if (kprof->kp_sites[i].ks_site == 0) {
+				break;
+			}
 		}
+		i = (i + 1) & (PROF_MAXSITES-1);
 	}
 
-	kprintf("at 0x%08lx: size %-4lu  %u/%u free\n",
-		(unsigned long)prpage, (unsigned long) sizes[blktype],
-		(unsigned) pr->nfree, n);
-	kprintf("   ");
-	for (i=0; i<n; i++) {
-		int val = (freemap[i/32] & (1<<(i%32)))!=0;
-		kprintf("%c", val ? '.' : '*');
-		if (i%64==63 && i<n-1) {
-			kprintf("\n   ");
-		}
+	/* Not there; I is a free slot. Keep one free so the loop ends. */
+	if (kprof->kp_nsites >= PROF_MAXSITES - 1) {
+		return 0;
 	}
-	kprintf("\n");
+	kprof->kp_sites[i].ks_site = site;
+	kprof->kp_nsites++;
+	return i;
 }
 
 /*
- * Print the whole heap.
+ * Record the allocation of SIZE bytes at PTR by SITE.
  */
+static
 void
-kheap_printstats(void)
+kprof_alloc(void *ptr, size_t size, vaddr_t site)
 {
-	struct pageref *pr;
+	struct kprof_live *kl;
+	struct kprof_site *ks;
+	unsigned i, b;
 
-	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	if (kprof == NULL && !kprof_init()) {
+		return;
+	}
 
-	kprintf("Subpage allocator status:\n");
+	spinlock_acquire(&kprof_spinlock);
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		subpage_stats(pr);
+	i = kprof->kp_freelive;
+	if (i == 0) {
+		kprof->kp_untracked++;
+		spinlock_release(&kprof_spinlock);
+		return;
 	}
-
-	spinlock_release(&kmalloc_spinlock);
+	kl = &kprof->kp_live[i];
+	kprof->kp_freelive = kl->kl_next;
+
+	kl->kl_ptr = (vaddr_t)ptr;
+	kl->kl_size = size;
+	kl->kl_site = kprof_getsite(site);
+	kl->kl_generation = profgeneration;
+
+	b = PROF_PTRHASH(kl->kl_ptr);
+	kl->kl_next = kprof->kp_buckets[b];
+	kprof->kp_buckets[b] = i;
+
+	ks = &kprof->kp_sites[kl->kl_site];
+	ks->ks_live++;
+	ks->ks_bytes += size;
+	ks->ks_allocs++;
+	ks->ks_genlive++;
+	ks->ks_genbytes += size;
+	ks->ks_genallocs++;
+
+	spinlock_release(&kprof_spinlock);
 }
 
-////////////////////////////////////////
-
 /*
- * Remove a pageref from both lists that it's on.
+ * Record the freeing of PTR, if it was tracked.
  */
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+kprof_free(void *ptr)
 {
-	struct pageref **guy;
+	struct kprof_live *kl;
+	struct kprof_site *ks;
+	uint16_t *ip;
 
-	KASSERT(blktype>=0 && blktype<NSIZES);
+	if (kprof == NULL) {
+		return;
+	}
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
+	spinlock_acquire(&kprof_spinlock);
+
+	for (ip = &kprof->kp_buckets[PROF_PTRHASH((vaddr_t)ptr)]; *ip != 0;
+	     ip = &kprof->kp_live[*ip].kl_next) {
+		kl = &kprof->kp_live[*ip];
+		if (kl->kl_ptr != (vaddr_t)ptr) {
+			continue;
 		}
-	}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
+		ks = &kprof->kp_sites[kl->kl_site];
+		KASSERT(ks->ks_live > 0);
+		ks->ks_live--;
+		ks->ks_bytes -= kl->kl_size;
+		if (kl->kl_generation == (uint16_t)profgeneration) {
+			ks->ks_genlive--;
+			ks->ks_genbytes -= kl->kl_size;
 		}
+
+		/* unlink it and put it on the free list */
+		kl->kl_ptr = 0;
+		*ip = kl->kl_next;
+		kl->kl_next = kprof->kp_freelive;
+		kprof->kp_freelive = kl - kprof->kp_live;
+		break;
 	}
+
+	spinlock_release(&kprof_spinlock);
 }
 
 /*
- * Given a requested client size, return the block type, that is, the
- * index into the sizes[] array for the block size to use.
+ * Start a new generation: the per-generation counts start over.
  */
 static
-inline
-int blocktype(size_t clientsz)
+void
+kprof_nextgeneration(void)
 {
 	unsigned i;
-	for (i=0; i<NSIZES; i++) {
-		if (clientsz <= sizes[i]) {
-			return i;
+
+	spinlock_acquire(&kprof_spinlock);
+	profgeneration++;
+	if (kprof != NULL) {
+		for (i=0; i<PROF_MAXSITES; i++) {
+			kprof->kp_sites[i].ks_genlive = 0;
+			kprof->kp_sites[i].ks_genbytes = 0;
+			kprof->kp_sites[i].ks_genallocs = 0;
 		}
 	}
-
-	panic("Subpage allocator cannot handle allocation of size %zu\n",
-	      clientsz);
-
-	// keep compiler happy
-	return 0;
+	spinlock_release(&kprof_spinlock);
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Fill TOP with the indexes of (up to) the PROF_TOP sites with the
+ * largest KEY, largest first. Returns how many there are.
  */
 static
-void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+unsigned
+kprof_topsites(unsigned *top, unsigned long (*key)(struct kprof_site *))
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
+	unsigned i, j, n = 0;
+	unsigned long k;
 
-	volatile int i;
+	for (i=0; i<PROF_MAXSITES; i++) {
+		if (kprof->kp_sites[i].ks_allocs == 0) {
+			continue;
+		}
+		k = key(&kprof->kp_sites[i]);
+		if (n < PROF_TOP) {
+			n++;
+		}
+		else if (key(&kprof->kp_sites[top[n-1]]) >= k) {
+			continue;
+		}
+		/* insertion sort into top[], dropping the last one */
+		for (j = n-1; j > 0; j--) {
+			if (key(&kprof->kp_sites[top[j-1]]) >= k) {
+				break;
+			}
+			top[j] = top[j-1];
+		}
+		top[j] = i;
+	}
+	return n;
+}
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
+static
+unsigned long
+kprof_bybytes(struct kprof_site *ks)
+{
+	return ks->ks_bytes;
+}
 
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
+static
+unsigned long
+kprof_byallocs(struct kprof_site *ks)
+{
+	return ks->ks_allocs;
+}
 
-	spinlock_acquire(&kmalloc_spinlock);
+static
+unsigned long
+kprof_bygenbytes(struct kprof_site *ks)
+{
+	return ks->ks_genbytes;
+}
 
-	checksubpages();
+static
+void
+kprof_printsites(const char *title, unsigned long (*key)(struct kprof_site *))
+{
+	struct kprof_site *ks;
+	unsigned top[PROF_TOP];
+	unsigned i, n;
+
+	n = kprof_topsites(top, key);
+	kprintf("%s:\n", title);
+	kprintf("  %-10s %7s %9s %9s | %7s %9s %9s\n", "site",
+		"live", "bytes", "allocs", "+live", "+bytes", "+allocs");
+	for (i=0; i<n; i++) {
+		ks = &kprof->kp_sites[top[i]];
+		if (ks->ks_site == 0) {
+			kprintf("  %-10s", "(other)");
+		}
+		else {
+			kprintf("  0x%08lx", (unsigned long)ks->ks_site);
+		}
+		kprintf(" %7u %9lu %9lu | %7u %9lu %9lu\n",
+			ks->ks_live, ks->ks_bytes, ks->ks_allocs,
+			ks->ks_genlive, ks->ks_genbytes, ks->ks_genallocs);
+	}
+}
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+#endif /* PROFILE */
 
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
+void
+kheap_profile(void)
+{
+#ifdef PROFILE
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kprof_spinlock);
+	if (kprof == NULL) {
+		spinlock_release(&kprof_spinlock);
+		kprintf("No allocations profiled yet.\n");
+		return;
+	}
+	kprintf("Kernel heap allocation sites, generation %u "
+		"(+ columns are this generation; %lu allocations untracked):\n",
+		profgeneration, kprof->kp_untracked);
+	kprof_printsites("By live bytes", kprof_bybytes);
+	kprof_printsites("By allocations", kprof_byallocs);
+	kprof_printsites("By live bytes this generation", kprof_bygenbytes);
+	spinlock_release(&kprof_spinlock);
+#else
+	kprintf("Enable PROFILE in kmalloc.c to use this functionality.\n");
+#endif
+}
+
+void
+kheap_nextgeneration(void)
+{
+#ifdef LABELS
+	spinlock_acquire(&kmalloc_spinlock);
+	mallocgeneration++;
+	spinlock_release(&kmalloc_spinlock);
+#endif
+#ifdef PROFILE
+	kprof_nextgeneration();
+#endif
+}
+
+void
+kheap_dump(void)
+{
+#ifdef LABELS
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kmalloc_spinlock);
+	dump_subpages(mallocgeneration);
+	spinlock_release(&kmalloc_spinlock);
+#else
+	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
+#endif
+}
+
+void
+kheap_dumpall(void)
+{
+#ifdef LABELS
+	unsigned i;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<=mallocgeneration; i++) {
+		dump_subpages(i);
+	}
+	spinlock_release(&kmalloc_spinlock);
+#else
+	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
+#endif
+}
+
+////////////////////////////////////////
+//
+// Per-cpu magazines.
+//
+//    Each cpu caches free blocks of each size in two magazines (small
+//    arrays of blocks), which it uses with interrupts off and no lock.
+//    Allocations take a block from the loaded magazine, frees put one
+//    back. When the loaded magazine runs empty (on alloc) or full (on
+//    free) it is swapped with the previous one; when that doesn't help
+//    either, a magazine is exchanged with the depot: an empty one for
+//    a full one on alloc, a full one for an empty one on free. Only
+//    the depot has a lock of its own, and only when it can't help do
+//    we go to the page lists under kmalloc_spinlock. (This is the
+//    scheme of Bonwick and Adams, "Magazines and Vmem", 2001.)
+//
+//    As far as the page lists know, blocks in magazines are allocated.
+//    They are deadbeefed and their guard bands checked when freed,
+//    and get new guard bands and labels when handed out again, so
+//    GUARDS and LABELS work as before. CHECKGUARDS, though, would find
+//    the guard bands of blocks in magazines wiped, so it turns the
+//    magazines off.
+//
+//    The depot keeps at most DEPOT_MAXFULL full magazines of each size;
+//    past that, frees go to the page lists so that pages can still
+//    become free and be released. Empty magazines are kept on a single
+//    list, as they fit any size. New ones are made a page at a time,
+//    only on the way to the page lists (where we may sleep anyway),
+//    and only if there are no empty ones left.
+//
+//    When memory runs low, kmalloc_drain gives the blocks in the depot
+//    and in this cpu's magazines back to the page lists, so that pages
+//    they keep from being all free can be released. (The other cpus'
+//    magazines can't be touched from here.)
+//
+
+#ifndef CHECKGUARDS
+#define MAGAZINES
+#endif
+
+#ifdef MAGAZINES
+
+/* Blocks per magazine: makes a magazine 64 bytes */
+#define MAG_ROUNDS 14
+
+/* Full magazines kept in the depot per size */
+#define DEPOT_MAXFULL 4
+
+static void subpage_putblock(vaddr_t ptraddr, int blktype);
+
+struct magazine {
+	struct magazine *next;		/* on a depot list */
+	unsigned nrounds;		/* blocks in rounds[] */
+	void *rounds[MAG_ROUNDS];
+};
+
+struct kmalloc_cpu {
+	struct magazine *loaded[NSIZES];
+	struct magazine *previous[NSIZES];
+	unsigned long hits;		/* allocs done from a magazine */
+	unsigned long misses;		/* allocs that went to the page lists */
+};
+
+static struct kmalloc_cpu kmalloc_cpus[MAXCPUS];
+
+static struct spinlock depot_spinlock = SPINLOCK_INITIALIZER;
+static struct magazine *depot_full[NSIZES];
+static unsigned depot_nfull[NSIZES];
+static struct magazine *depot_empty;
+static unsigned long depot_exchanges;
+
+static
+void
+depot_push(struct magazine **list, struct magazine *m)
+{
+	KASSERT(spinlock_do_i_hold(&depot_spinlock));
+	m->next = *list;
+	*list = m;
+}
+
+static
+struct magazine *
+depot_pop(struct magazine **list)
+{
+	struct magazine *m;
+
+	KASSERT(spinlock_do_i_hold(&depot_spinlock));
+	m = *list;
+	if (m != NULL) {
+		*list = m->next;
+		m->next = NULL;
+	}
+	return m;
+}
+
+/*
+ * Make a page worth of empty magazines, if there are none and we may
+ * sleep.
+ */
+static
+void
+magazine_grow(void)
+{
+	struct magazine *m;
+	vaddr_t va;
+	unsigned i;
+
+	if (depot_empty != NULL || !CURCPU_EXISTS() ||
+	    curthread->t_in_interrupt || curcpu->c_spinlocks > 0) {
+		return;
+	}
+
+	va = alloc_kpages(1);
+	if (va == 0) {
+		return;
+	}
+	m = (struct magazine *)va;
+
+	spinlock_acquire(&depot_spinlock);
+	for (i=0; i<PAGE_SIZE / sizeof(*m); i++) {
+		m[i].nrounds = 0;
+		depot_push(&depot_empty, &m[i]);
+	}
+	spinlock_release(&depot_spinlock);
+}
+
+/*
+ * Get a free block of type BLKTYPE from this cpu's magazines, or from
+ * the depot. Returns NULL if there is none there.
+ */
+static
+void *
+magazine_alloc(unsigned blktype)
+{
+	struct kmalloc_cpu *kc;
+	struct magazine *m, *prev, *full;
+	void *block = NULL;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* too early in boot */
+		return NULL;
+	}
+
+	spl = splhigh();
+	kc = &kmalloc_cpus[curcpu->c_number];
+
+	m = kc->loaded[blktype];
+	prev = kc->previous[blktype];
+	if (m == NULL || m->nrounds == 0) {
+		if (prev != NULL && prev->nrounds > 0) {
+			/* The previous magazine has blocks: swap */
+			kc->loaded[blktype] = prev;
+			kc->previous[blktype] = m;
+		}
+		else {
+			/* Trade the (empty) previous one for a full one */
+			spinlock_acquire(&depot_spinlock);
+			full = depot_pop(&depot_full[blktype]);
+			if (full != NULL) {
+				depot_nfull[blktype]--;
+				if (prev != NULL) {
+					depot_push(&depot_empty, prev);
+				}
+				kc->previous[blktype] = m;
+				kc->loaded[blktype] = full;
+				depot_exchanges++;
+			}
+			spinlock_release(&depot_spinlock);
+		}
+		m = kc->loaded[blktype];
+	}
+
+	if (m != NULL && m->nrounds > 0) {
+		block = m->rounds[--m->nrounds];
+		kc->hits++;
+	}
+	else {
+		kc->misses++;
+	}
+
+	splx(spl);
+	return block;
+}
+
+/*
+ * Put BLOCK, a free block of type BLKTYPE, in this cpu's magazines.
+ * Returns false if there was no room for it.
+ */
+static
+bool
+magazine_free(unsigned blktype, void *block)
+{
+	struct kmalloc_cpu *kc;
+	struct magazine *m, *prev, *empty;
+	bool done = false;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+
+	spl = splhigh();
+	kc = &kmalloc_cpus[curcpu->c_number];
+
+	m = kc->loaded[blktype];
+	prev = kc->previous[blktype];
+	if (m == NULL || m->nrounds == MAG_ROUNDS) {
+		if (prev != NULL && prev->nrounds < MAG_ROUNDS) {
+			/* The previous magazine has room: swap */
+			kc->loaded[blktype] = prev;
+			kc->previous[blktype] = m;
+		}
+		else {
+			/* Trade the (full) previous one for an empty one */
+			spinlock_acquire(&depot_spinlock);
+			if (prev == NULL ||
+			    depot_nfull[blktype] < DEPOT_MAXFULL) {
+				empty = depot_pop(&depot_empty);
+				if (empty != NULL) {
+					if (prev != NULL) {
+						depot_push(&depot_full[blktype],
+							   prev);
+						depot_nfull[blktype]++;
+					}
+					kc->previous[blktype] = m;
+					kc->loaded[blktype] = empty;
+					depot_exchanges++;
+				}
+			}
+			spinlock_release(&depot_spinlock);
+		}
+		m = kc->loaded[blktype];
+	}
+
+	if (m != NULL && m->nrounds < MAG_ROUNDS) {
+		m->rounds[m->nrounds++] = block;
+		done = true;
+	}
+
+	splx(spl);
+	return done;
+}
+
+/*
+ * Give the blocks in M, a magazine of type BLKTYPE no one else can
+ * see, back to the page lists, and put M on the depot's empty list.
+ */
+static
+void
+magazine_empty(struct magazine *m, unsigned blktype)
+{
+	while (m->nrounds > 0) {
+		subpage_putblock((vaddr_t)m->rounds[--m->nrounds], blktype);
+	}
+	spinlock_acquire(&depot_spinlock);
+	depot_push(&depot_empty, m);
+	spinlock_release(&depot_spinlock);
+}
+
+/*
+ * Empty the depot's full magazines and this cpu's own magazines.
+ */
+static
+void
+magazine_drain(void)
+{
+	struct kmalloc_cpu *kc;
+	struct magazine *loaded, *prev, *full;
+	unsigned j;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	for (j=0; j<NSIZES; j++) {
+		/* Take this cpu's magazines away, so they're ours alone */
+		spl = splhigh();
+		kc = &kmalloc_cpus[curcpu->c_number];
+		loaded = kc->loaded[j];
+		prev = kc->previous[j];
+		kc->loaded[j] = NULL;
+		kc->previous[j] = NULL;
+		splx(spl);
+
+		if (loaded != NULL) {
+			magazine_empty(loaded, j);
+		}
+		if (prev != NULL) {
+			magazine_empty(prev, j);
+		}
+
+		while (1) {
+			spinlock_acquire(&depot_spinlock);
+			full = depot_pop(&depot_full[j]);
+			if (full != NULL) {
+				depot_nfull[j]--;
+			}
+			spinlock_release(&depot_spinlock);
+			if (full == NULL) {
+				break;
+			}
+			magazine_empty(full, j);
+		}
+	}
+}
+
+/*
+ * Print how the magazines are doing. The other cpus' magazines are
+ * looked at without stopping them, so the counts are approximate.
+ */
+static
+void
+magazine_stats(void)
+{
+	unsigned long hits = 0, misses = 0, cached;
+	struct magazine *m;
+	unsigned i, j;
+
+	for (i=0; i<MAXCPUS; i++) {
+		hits += kmalloc_cpus[i].hits;
+		misses += kmalloc_cpus[i].misses;
+	}
+	kprintf("Magazines: %lu hits, %lu misses, %lu depot exchanges\n",
+		hits, misses, depot_exchanges);
+
+	kprintf("   cached blocks:");
+	for (j=0; j<NSIZES; j++) {
+		cached = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			m = kmalloc_cpus[i].loaded[j];
+			cached += m != NULL ? m->nrounds : 0;
+			m = kmalloc_cpus[i].previous[j];
+			cached += m != NULL ? m->nrounds : 0;
+		}
+		spinlock_acquire(&depot_spinlock);
+		cached += depot_nfull[j] * MAG_ROUNDS;
+		spinlock_release(&depot_spinlock);
+		kprintf(" %lu/%lu", cached, (unsigned long)sizes[j]);
+	}
+	kprintf("\n");
+}
+
+#else /* not MAGAZINES */
+
+#define magazine_grow()
+#define magazine_alloc(blktype) ((void)(blktype), (void *)NULL)
+#define magazine_free(blktype, block) ((void)(blktype), (void)(block), false)
+#define magazine_drain()
+#define magazine_stats()
+
+#endif /* MAGAZINES */
+
+////////////////////////////////////////
+
+/*
+ * Print the allocated/freed map of a single kernel heap page.
+ */
+static
+void
+subpage_stats(struct pageref *pr)
+{
+	vaddr_t prpage, fla;
+	struct freelist *fl;
+	int blktype;
+	unsigned i, n, index;
+	uint32_t freemap[PAGE_SIZE / (SMALLEST_SUBPAGE_SIZE*32)];
+
+	checksubpage(pr);
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	/* clear freemap[] */
+	for (i=0; i<ARRAYCOUNT(freemap); i++) {
+		freemap[i] = 0;
+	}
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+
+	/* compute how many bits we need in freemap and assert we fit */
+	n = PAGE_SIZE / sizes[blktype];
+	KASSERT(n <= 32 * ARRAYCOUNT(freemap));
+
+	if (pr->freelist_offset != INVALID_OFFSET) {
+		fla = prpage + pr->freelist_offset;
+		fl = (struct freelist *)fla;
+
+		for (; fl != NULL; fl = fl->next) {
+			fla = (vaddr_t)fl;
+			index = (fla-prpage) / sizes[blktype];
+			KASSERT(index<n);
+			freemap[index/32] |= (1<<(index%32));
+		}
+	}
+
+	kprintf("at 0x%08lx: size %-4lu  %u/%u free\n",
+		(unsigned long)prpage, (unsigned long) sizes[blktype],
+		(unsigned) pr->nfree, n);
+	kprintf("   ");
+	for (i=0; i<n; i++) {
+		int val = (freemap[i/32] & (1<<(i%32)))!=0;
+		kprintf("%c", val ? '.' : '*');
+		if (i%64==63 && i<n-1) {
+			kprintf("\n   ");
+		}
+	}
+	kprintf("\n");
+}
+
+/*
+ * Print the whole heap.
+ */
+void
+kheap_printstats(void)
+{
+	struct pageref *pr;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kmalloc_spinlock);
+
+	kprintf("Subpage allocator status:\n");
+
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		subpage_stats(pr);
+	}
+
+	spinlock_release(&kmalloc_spinlock);
+
+	magazine_stats();
+}
+
+/*
+ * Give free blocks cached in the magazines back to the page lists,
+ * so that pages that are then all free go back to the page allocator.
+ * Called when memory is tight.
+ */
+void
+kmalloc_drain(void)
+{
+	magazine_drain();
+}
+
+////////////////////////////////////////
+
+/*
+ * Remove a pageref from both lists that it's on.
+ */
+static
+void
+remove_lists(struct pageref *pr, int blktype)
+{
+	struct pageref **guy;
+
+	KASSERT(blktype>=0 && blktype<NSIZES);
+
+	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
+		checksubpage(*guy);
+		if (*guy == pr) {
+			*guy = pr->next_samesize;
+			break;
+		}
+	}
+
+	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
+		checksubpage(*guy);
+		if (*guy == pr) {
+			*guy = pr->next_all;
+			break;
+		}
+	}
+}
+
+/*
+ * Given a requested client size, return the block type, that is, the
+ * index into the sizes[] array for the block size to use.
+ */
+static
+inline
+int blocktype(size_t clientsz)
+{
+	unsigned i;
+	for (i=0; i<NSIZES; i++) {
+		if (clientsz <= sizes[i]) {
+			return i;
+		}
+	}
+
+	panic("Subpage allocator cannot handle allocation of size %zu\n",
+	      clientsz);
+
+	// keep compiler happy
+	return 0;
+}
+
+////////////////////////////////////////
+
+/*
+ * Get a free block of type BLKTYPE from the page lists, making a new
+ * page of such blocks if needed.
+ */
+static
+void *
+subpage_getblock(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for page we're allocating from
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+	void *retptr;		// our result
+
+	volatile int i;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
 
 		if (pr->nfree > 0) {
 
@@ -940,12 +1720,6 @@ subpage_kmalloc(size_t sz
 				KASSERT(pr->nfree == 0);
 				pr->freelist_offset = INVALID_OFFSET;
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
 
 			checksubpages();
 
@@ -964,6 +1738,9 @@ subpage_kmalloc(size_t sz
 	 */
 
 	spinlock_release(&kmalloc_spinlock);
+	if (kheap_pagetypes == NULL) {
+		kheap_pagetypes_init();
+	}
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
@@ -1013,69 +1790,94 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	kheap_setpagetype(prpage, blktype);
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
 /*
- * Free a pointer previously returned from subpage_kmalloc. If the
- * pointer is not on any heap page we recognize, return -1.
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
  */
 static
-int
-subpage_kfree(void *ptr)
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
-	struct pageref *pr;	// pageref for page we're freeing in
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
 #ifdef GUARDS
-	size_t blocksize, smallerblocksize;
+	size_t clientsz;
 #endif
 
-	ptraddr = (vaddr_t)ptr;
 #ifdef GUARDS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/*
-		 * With guard bands, all client-facing subpage
-		 * pointers are offset by GUARD_PTROFFSET (which is 4)
-		 * from the underlying blocks and are therefore not
-		 * page-aligned. So a page-aligned pointer is not one
-		 * of ours. Catch this up front, as otherwise
-		 * subtracting GUARD_PTROFFSET could give a pointer on
-		 * a page we *do* own, and then we'll panic because
-		 * it's not a valid one.
-		 */
-		return -1;
-	}
-	ptraddr -= GUARD_PTROFFSET;
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
 #endif
 #ifdef LABELS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/* ditto */
-		return -1;
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	retptr = magazine_alloc(blktype);
+	if (retptr == NULL) {
+		/* Make sure frees will find empty magazines */
+		magazine_grow();
+
+		retptr = subpage_getblock(blktype);
+		if (retptr == NULL) {
+			return NULL;
+		}
 	}
-	ptraddr -= LABEL_PTROFFSET;
+
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
 #endif
 
+	return retptr;
+}
+
+/*
+ * Put the free block at PTRADDR, of type BLKTYPE, back on its page's
+ * freelist, and release the page if it becomes all free.
+ */
+static
+void
+subpage_putblock(vaddr_t ptraddr, int blktype)
+{
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
 	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
 	prpage = 0;
-	blktype = 0;
 
 	for (pr = allbase; pr; pr = pr->next_all) {
 		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
 
 		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
+		KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
 		checksubpage(pr);
 
 		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
@@ -1083,31 +1885,12 @@ subpage_kfree(void *ptr)
 		}
 	}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+	/* kheap_pagetypes said it's ours */
+	KASSERT(pr != NULL);
+	KASSERT((int)PR_BLOCKTYPE(pr) == blktype);
 
 	offset = ptraddr - prpage;
 
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
-	}
-
-#ifdef GUARDS
-	blocksize = sizes[blktype];
-	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
-	checkguardband(ptraddr, smallerblocksize, blocksize);
-#endif
-
-	/*
-	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
-	 */
-	fill_deadbeef((void *)ptraddr, sizes[blktype]);
-
 	/*
 	 * We probably ought to check for free twice by seeing if the block
 	 * is already on the free list. But that's expensive, so we don't.
@@ -1142,6 +1925,7 @@ subpage_kfree(void *ptr)
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
+		kheap_setpagetype(prpage, -1);
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
@@ -1155,6 +1939,77 @@ subpage_kfree(void *ptr)
 	checksubpages();
 	spinlock_release(&kmalloc_spinlock);
 #endif
+}
+
+/*
+ * Free a pointer previously returned from subpage_kmalloc. If the
+ * pointer is not on any heap page we recognize, return -1.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t ptraddr;	// same as ptr
+	vaddr_t offset;		// offset into page
+#ifdef GUARDS
+	size_t blocksize, smallerblocksize;
+#endif
+
+	ptraddr = (vaddr_t)ptr;
+#ifdef GUARDS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/*
+		 * With guard bands, all client-facing subpage
+		 * pointers are offset by GUARD_PTROFFSET (which is 4)
+		 * from the underlying blocks and are therefore not
+		 * page-aligned. So a page-aligned pointer is not one
+		 * of ours. Catch this up front, as otherwise
+		 * subtracting GUARD_PTROFFSET could give a pointer on
+		 * a page we *do* own, and then we'll panic because
+		 * it's not a valid one.
+		 */
+		return -1;
+	}
+	ptraddr -= GUARD_PTROFFSET;
+#endif
+#ifdef LABELS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* ditto */
+		return -1;
+	}
+	ptraddr -= LABEL_PTROFFSET;
+#endif
+
+	blktype = kheap_pagetype(ptraddr);
+	if (blktype < 0) {
+		/* Not on any of our pages - not a subpage allocation */
+		return -1;
+	}
+	KASSERT(blktype < NSIZES);
+
+	offset = ptraddr % PAGE_SIZE;
+
+	/* Check for proper positioning and alignment */
+	if (offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+#ifdef GUARDS
+	blocksize = sizes[blktype];
+	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
+	checkguardband(ptraddr, smallerblocksize, blocksize);
+#endif
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+
+	if (!magazine_free(blktype, (void *)ptraddr)) {
+		subpage_putblock(ptraddr, blktype);
+	}
 
 	return 0;
 }
@@ -1170,39 +2025,52 @@ void *
 kmalloc(size_t sz)
 {
 	size_t checksz;
-#ifdef LABELS
+	void *ptr;
+#if defined(LABELS) || defined(PROFILE)
 	vaddr_t label;
 #endif
 
-#ifdef LABELS
+#if defined(LABELS) || defined(PROFILE)
 #ifdef __GNUC__
 	label = (vaddr_t)__builtin_return_address(0);
 #else
 #error "Don't know how to get return address with this compiler"
 #endif /* __GNUC__ */
-#endif /* LABELS */
+#endif /* LABELS || PROFILE */
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
 
-		/* Round up to a whole number of pages. */
+		/*
+		 * Round up to a whole number of pages. These needn't
+		 * be physically contiguous, so that large tables can
+		 * be had even when physical memory is fragmented.
+		 */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
+		address = alloc_kvpages(npages);
 		if (address==0) {
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
 
-		return (void *)address;
+		ptr = (void *)address;
 	}
-
+	else {
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+		ptr = subpage_kmalloc(sz, label);
 #else
-	return subpage_kmalloc(sz);
+		ptr = subpage_kmalloc(sz);
+#endif
+	}
+
+#ifdef PROFILE
+	if (ptr != NULL) {
+		kprof_alloc(ptr, sz, label);
+	}
 #endif
+	return ptr;
 }
 
 /*
@@ -1216,7 +2084,11 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#ifdef PROFILE
+	kprof_free(ptr);
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,222 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <vmstats.h>
+#include <kvmap.h>
+
+/*
+ * Virtually contiguous kernel allocations. See kvmap.h.
+ *
+ * kvmap_pte[] has an entry per page of the range: the frame the page
+ * is mapped to, if any, and the state of the page. A range is handed
+ * out only once all its entries are KVM_MAPPED, and the last one is
+ * marked KVM_LAST so that kvmap_free knows where it ends. Entries
+ * change under kvmap_lock; kvmap_translate reads a single one
+ * without it, as the fault handler must not take locks.
+ *
+ * Freed pages go KVM_STALE, as other cpus may still have their
+ * translations. A purge marks every stale page KVM_PURGING, flushes
+ * the TLB of every cpu, and then makes the purging pages free. Pages
+ * freed while the flush is under way stay stale until the next purge.
+ */
+
+#define KVM_STATE    0x7
+#define KVM_FREE     0    /* unused */
+#define KVM_STALE    1    /* freed; may still be in some TLB */
+#define KVM_PURGING  2    /* stale, and a purge is under way */
+#define KVM_RESERVED 3    /* being set up by kvmap_alloc */
+#define KVM_MAPPED   4    /* mapped to the frame in PAGE_FRAME */
+#define KVM_LAST     0x8  /* last page of a range */
+
+#define KVM_INDEX(va) (((va) - KVMAP_BASE) / PAGE_SIZE)
+#define KVM_VADDR(i)  (KVMAP_BASE + (vaddr_t)(i) * PAGE_SIZE)
+
+static uint32_t *kvmap_pte;
+static struct spinlock kvmap_lock = SPINLOCK_INITIALIZER;
+/* where the next search starts */
+static unsigned kvmap_hand;
+/* pages waiting for a purge */
+static unsigned kvmap_nstale;
+
+void kvmap_bootstrap(void)
+{
+  size_t size = KVMAP_NPAGES * sizeof(kvmap_pte[0]);
+
+  /* In kseg0: the fault handler reads it */
+  kvmap_pte = (uint32_t *)alloc_kpages(DIVROUNDUP(size, PAGE_SIZE));
+  if (kvmap_pte == NULL) {
+    panic("kvmap: cannot allocate the page table\n");
+  }
+  bzero(kvmap_pte, size);
+}
+
+/*
+ * Find NPAGES free pages in a row, starting the search at the hand,
+ * and mark them KVM_RESERVED. Return the index of the first one, or
+ * -1 if there's no such run.
+ */
+static int kvmap_reserve(unsigned npages)
+{
+  unsigned i, start, run, scanned;
+
+  KASSERT(spinlock_do_i_hold(&kvmap_lock));
+
+  start = kvmap_hand;
+  run = 0;
+  for (scanned = 0; scanned < KVMAP_NPAGES + npages; scanned++) {
+    i = (kvmap_hand + scanned) % KVMAP_NPAGES;
+    if (i == 0) {
+      /* runs don't wrap around */
+      run = 0;
+    }
+    if ((kvmap_pte[i] & KVM_STATE) != KVM_FREE) {
+      run = 0;
+      continue;
+    }
+    if (run == 0) {
+      start = i;
+    }
+    if (++run == npages) {
+      for (i = start; i < start + npages; i++) {
+        kvmap_pte[i] = KVM_RESERVED;
+      }
+      kvmap_hand = (start + npages) % KVMAP_NPAGES;
+      return start;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Make the stale pages free again: flush every TLB in between.
+ */
+static void kvmap_purge(void)
+{
+  unsigned i;
+
+  spinlock_acquire(&kvmap_lock);
+  for (i = 0; i < KVMAP_NPAGES; i++) {
+    if ((kvmap_pte[i] & KVM_STATE) == KVM_STALE) {
+      kvmap_pte[i] = KVM_PURGING;
+      kvmap_nstale--;
+    }
+  }
+  spinlock_release(&kvmap_lock);
+
+  vm_tlb_flushall();
+  vmstats_inc(VMS_KVMAP_PURGES);
+
+  spinlock_acquire(&kvmap_lock);
+  for (i = 0; i < KVMAP_NPAGES; i++) {
+    if ((kvmap_pte[i] & KVM_STATE) == KVM_PURGING) {
+      kvmap_pte[i] = KVM_FREE;
+    }
+  }
+  spinlock_release(&kvmap_lock);
+}
+
+vaddr_t kvmap_alloc(unsigned npages)
+{
+  paddr_t paddr;
+  unsigned i;
+  int first;
+
+  KASSERT(npages > 0);
+
+  if (kvmap_pte == NULL || npages > KVMAP_NPAGES) {
+    return 0;
+  }
+
+  spinlock_acquire(&kvmap_lock);
+  first = kvmap_reserve(npages);
+  if (first < 0 && kvmap_nstale > 0) {
+    /* Freed pages may make room, once nobody can be using them */
+    spinlock_release(&kvmap_lock);
+    kvmap_purge();
+    spinlock_acquire(&kvmap_lock);
+    first = kvmap_reserve(npages);
+  }
+  spinlock_release(&kvmap_lock);
+  if (first < 0) {
+    return 0;
+  }
+
+  /* The reserved entries are ours until they're handed out */
+  for (i = 0; i < npages; i++) {
+    paddr = coremap_alloc(1);
+    if (paddr == 0) {
+      break;
+    }
+    kvmap_pte[first + i] = paddr | KVM_RESERVED;
+  }
+
+  spinlock_acquire(&kvmap_lock);
+  if (i < npages) {
+    /* Out of memory: nothing was mapped yet, so nothing is stale */
+    while (i-- > 0) {
+      coremap_free(kvmap_pte[first + i] & PAGE_FRAME);
+    }
+    for (i = 0; i < npages; i++) {
+      kvmap_pte[first + i] = KVM_FREE;
+    }
+    spinlock_release(&kvmap_lock);
+    return 0;
+  }
+  for (i = 0; i < npages; i++) {
+    kvmap_pte[first + i] = (kvmap_pte[first + i] & PAGE_FRAME) | KVM_MAPPED;
+  }
+  kvmap_pte[first + npages - 1] |= KVM_LAST;
+  spinlock_release(&kvmap_lock);
+
+  vmstats_inc(VMS_KVMAP_ALLOCS);
+  return KVM_VADDR(first);
+}
+
+void kvmap_free(vaddr_t vaddr)
+{
+  unsigned i;
+  uint32_t pte;
+
+  KASSERT(vaddr >= KVMAP_BASE && vaddr < KVMAP_TOP);
+  KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+  spinlock_acquire(&kvmap_lock);
+  i = KVM_INDEX(vaddr);
+  KASSERT(i == 0 || (kvmap_pte[i - 1] & KVM_STATE) != KVM_MAPPED ||
+          (kvmap_pte[i - 1] & KVM_LAST));
+  do {
+    KASSERT(i < KVMAP_NPAGES);
+    pte = kvmap_pte[i];
+    if ((pte & KVM_STATE) != KVM_MAPPED) {
+      panic("kvmap: free of unmapped page 0x%x\n", KVM_VADDR(i));
+    }
+    /*
+     * The frame can go right away: a stale translation could only be
+     * used through a dangling pointer, which kseg0 would let through
+     * just the same.
+     */
+    coremap_free(pte & PAGE_FRAME);
+    kvmap_pte[i] = KVM_STALE;
+    kvmap_nstale++;
+    i++;
+  } while (!(pte & KVM_LAST));
+  spinlock_release(&kvmap_lock);
+}
+
+paddr_t kvmap_translate(vaddr_t vaddr)
+{
+  uint32_t pte;
+
+  if (kvmap_pte == NULL || vaddr < KVMAP_BASE || vaddr >= KVMAP_TOP) {
+    return 0;
+  }
+
+  pte = kvmap_pte[KVM_INDEX(vaddr)];
+  if ((pte & KVM_STATE) != KVM_MAPPED) {
+    return 0;
+  }
+  return pte & PAGE_FRAME;
+}
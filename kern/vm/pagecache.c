@@ -0,0 +1,254 @@
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+
+/*
+ * Page cache of read-only executable pages. See pagecache.h.
+ *
+ * Everything is protected by pc_lock. A new reference to a cached
+ * frame is only handed out under the lock, so a frame found with a
+ * single reference (the cache's) under the lock is unmapped and
+ * stays so: it can be freed.
+ *
+ * pe_vnode is never dereferenced, as the vnode may be gone; only the
+ * vnode passed in by a caller, which holds a reference to it, is.
+ */
+
+struct pc_entry {
+  struct vnode *pe_vnode;
+  unsigned pe_vnid;             /* vn_id of pe_vnode */
+  unsigned pe_version;          /* vn_version when the page was read */
+  off_t pe_offset;
+  size_t pe_len;
+  paddr_t pe_paddr;
+  struct pc_entry *pe_next;
+};
+
+static struct pc_entry *pc_buckets[PC_NBUCKETS];
+static struct lock *pc_lock;
+static unsigned pc_hand;                /* next bucket to reclaim from */
+
+static unsigned pc_npages;
+static unsigned long pc_hits;
+static unsigned long pc_misses;
+static unsigned long pc_reclaims;
+static unsigned long pc_stale;
+
+static unsigned pc_hash(struct vnode *v, off_t offset)
+{
+  return (((uintptr_t)v >> 4) ^ (unsigned)(offset / PAGE_SIZE)) % PC_NBUCKETS;
+}
+
+static struct pc_entry *pc_find(struct vnode *v, off_t offset, size_t len)
+{
+  struct pc_entry *pe;
+
+  for (pe = pc_buckets[pc_hash(v, offset)]; pe != NULL; pe = pe->pe_next) {
+    if (pe->pe_vnode == v && pe->pe_offset == offset && pe->pe_len == len) {
+      return pe;
+    }
+  }
+  return NULL;
+}
+
+static bool pc_current(struct pc_entry *pe, struct vnode *v, unsigned version)
+{
+  return pe->pe_vnid == v->vn_id && pe->pe_version == version;
+}
+
+/*
+ * Drop the cache's reference to the frame of PE and free PE, which
+ * must already be off its bucket.
+ */
+static void pc_drop(struct pc_entry *pe)
+{
+  KASSERT(lock_do_i_hold(pc_lock));
+
+  coremap_free(pe->pe_paddr);
+  kfree(pe);
+  pc_npages--;
+}
+
+/*
+ * Drop every entry at the address of V that isn't of its current
+ * contents: older versions of the file, or of an earlier vnode at
+ * the same address. Whoever has the frames mapped keeps them.
+ */
+static void pc_dropstale(struct vnode *v)
+{
+  struct pc_entry **pp, *pe;
+  unsigned i, version;
+
+  KASSERT(lock_do_i_hold(pc_lock));
+
+  version = vnode_getversion(v);
+  for (i = 0; i < PC_NBUCKETS; i++) {
+    pp = &pc_buckets[i];
+    while (*pp != NULL) {
+      pe = *pp;
+      if (pe->pe_vnode != v || pc_current(pe, v, version)) {
+        pp = &pe->pe_next;
+        continue;
+      }
+      *pp = pe->pe_next;
+      pc_drop(pe);
+      pc_stale++;
+    }
+  }
+}
+
+void pagecache_bootstrap(void)
+{
+  pc_lock = lock_create("pagecache");
+  if (pc_lock == NULL) {
+    panic("pagecache: out of memory\n");
+  }
+}
+
+paddr_t pagecache_lookup(struct vnode *v, off_t offset, size_t len)
+{
+  struct pc_entry *pe;
+  paddr_t paddr = 0;
+
+  lock_acquire(pc_lock);
+  pe = pc_find(v, offset, len);
+  if (pe != NULL && !pc_current(pe, v, vnode_getversion(v))) {
+    /* The file changed since: this page and its like are stale */
+    pc_dropstale(v);
+    pe = NULL;
+  }
+  if (pe != NULL) {
+    paddr = pe->pe_paddr;
+    coremap_incref(paddr);
+    pc_hits++;
+  } else {
+    pc_misses++;
+  }
+  lock_release(pc_lock);
+
+  return paddr;
+}
+
+paddr_t pagecache_insert(struct vnode *v, unsigned version, off_t offset,
+                         size_t len, paddr_t paddr, bool *shared)
+{
+  struct pc_entry *pe, *new;
+  paddr_t cached;
+  unsigned b;
+
+  /* Allocated outside the lock; we may well not need it */
+  new = kmalloc(sizeof(struct pc_entry));
+
+  lock_acquire(pc_lock);
+  if (vnode_getversion(v) != version) {
+    /* The file changed while we read: what we have may be torn */
+    lock_release(pc_lock);
+    if (new != NULL) {
+      kfree(new);
+    }
+    *shared = false;
+    return paddr;
+  }
+  pe = pc_find(v, offset, len);
+  if (pe != NULL && !pc_current(pe, v, version)) {
+    pc_dropstale(v);
+    pe = NULL;
+  }
+  if (pe != NULL) {
+    /* Someone else read the same page meanwhile: use theirs */
+    coremap_incref(pe->pe_paddr);
+    cached = pe->pe_paddr;
+    lock_release(pc_lock);
+    coremap_free(paddr);
+    if (new != NULL) {
+      kfree(new);
+    }
+    *shared = true;
+    return cached;
+  }
+
+  if (new == NULL) {
+    lock_release(pc_lock);
+    *shared = false;
+    return paddr;
+  }
+
+  new->pe_vnode = v;
+  new->pe_vnid = v->vn_id;
+  new->pe_version = version;
+  new->pe_offset = offset;
+  new->pe_len = len;
+  new->pe_paddr = paddr;
+  b = pc_hash(v, offset);
+  new->pe_next = pc_buckets[b];
+  pc_buckets[b] = new;
+  pc_npages++;
+
+  /* The cache's reference; also takes the frame away from the pager */
+  coremap_incref(paddr);
+  lock_release(pc_lock);
+
+  *shared = true;
+  return paddr;
+}
+
+unsigned pagecache_reclaim(unsigned npages)
+{
+  struct pc_entry **pp, *pe;
+  unsigned i, n = 0;
+
+  lock_acquire(pc_lock);
+  for (i = 0; i < PC_NBUCKETS && n < npages; i++) {
+    pp = &pc_buckets[pc_hand];
+    while (*pp != NULL && n < npages) {
+      pe = *pp;
+      if (coremap_refcount(pe->pe_paddr) > 1) {
+        /* Still mapped by someone */
+        pp = &pe->pe_next;
+        continue;
+      }
+      *pp = pe->pe_next;
+      pc_drop(pe);
+      pc_reclaims++;
+      n++;
+    }
+    pc_hand = (pc_hand + 1) % PC_NBUCKETS;
+  }
+  lock_release(pc_lock);
+
+  return n;
+}
+
+void pagecache_invalidate(struct vnode *v)
+{
+  lock_acquire(pc_lock);
+  pc_dropstale(v);
+  lock_release(pc_lock);
+}
+
+void pagecache_printstats(void)
+{
+  unsigned long hits, misses, total;
+
+  lock_acquire(pc_lock);
+  hits = pc_hits;
+  misses = pc_misses;
+  kprintf("Page cache: %u pages (%uk)\n", pc_npages,
+    pc_npages * (PAGE_SIZE / 1024));
+  kprintf("  %-30s %10lu\n", "Lookups", hits + misses);
+  kprintf("  %-30s %10lu\n", "Hits", hits);
+  kprintf("  %-30s %10lu\n", "Misses", misses);
+  kprintf("  %-30s %10lu\n", "Pages reclaimed", pc_reclaims);
+  kprintf("  %-30s %10lu\n", "Stale pages dropped", pc_stale);
+  lock_release(pc_lock);
+
+  total = hits + misses;
+  if (total > 0) {
+    kprintf("  Hit rate: %lu.%lu%%\n", hits * 100 / total,
+      (hits * 1000 / total) % 10);
+  }
+}
@@ -0,0 +1,106 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/*
+ * Two-level page tables. See pagetable.h.
+ */
+
+struct pagetable *pt_create(void)
+{
+  struct pagetable *pt;
+
+  pt = kmalloc(sizeof(struct pagetable));
+  if (pt == NULL) {
+    return NULL;
+  }
+  bzero(pt, sizeof(struct pagetable));
+
+  return pt;
+}
+
+void pt_destroy(struct pagetable *pt)
+{
+  unsigned i, j;
+  pte_t *table;
+
+  for (i = 0; i < PT_ENTRIES; i++) {
+    table = pt->pt_dir[i];
+    if (table == NULL) {
+      continue;
+    }
+    for (j = 0; j < PT_ENTRIES; j++) {
+      if (table[j] & PTE_VALID) {
+        /* Drops our reference; shared frames stay with the others */
+        coremap_free(table[j] & PTE_FRAME);
+      } else if (table[j] & PTE_SWAPPED) {
+        swap_release(PTE_SLOT(table[j]));
+      }
+    }
+    kfree(table);
+  }
+
+  kfree(pt);
+}
+
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+  pte_t *table;
+
+  table = pt->pt_dir[PT_DIRINDEX(vaddr)];
+  if (table == NULL) {
+    if (!create) {
+      return NULL;
+    }
+    table = kmalloc(PT_ENTRIES * sizeof(pte_t));
+    if (table == NULL) {
+      return NULL;
+    }
+    bzero(table, PT_ENTRIES * sizeof(pte_t));
+    pt->pt_dir[PT_DIRINDEX(vaddr)] = table;
+  }
+
+  return &table[PT_TABINDEX(vaddr)];
+}
+
+int pt_copy(struct pagetable *old, struct pagetable *new)
+{
+  unsigned i, j, slot;
+  pte_t *oldtable, *newtable;
+  int result;
+
+  for (i = 0; i < PT_ENTRIES; i++) {
+    oldtable = old->pt_dir[i];
+    if (oldtable == NULL) {
+      continue;
+    }
+
+    newtable = kmalloc(PT_ENTRIES * sizeof(pte_t));
+    if (newtable == NULL) {
+      /* What was copied so far is released by pt_destroy(new) */
+      return ENOMEM;
+    }
+    bzero(newtable, PT_ENTRIES * sizeof(pte_t));
+    new->pt_dir[i] = newtable;
+
+    for (j = 0; j < PT_ENTRIES; j++) {
+      if (oldtable[j] & PTE_VALID) {
+        coremap_incref(oldtable[j] & PTE_FRAME);
+        oldtable[j] |= PTE_COW;
+        newtable[j] = oldtable[j];
+      } else if (oldtable[j] & PTE_SWAPPED) {
+        result = swap_dup(PTE_SLOT(oldtable[j]), &slot);
+        if (result) {
+          return result;
+        }
+        newtable[j] = PTE_MKSWAP(slot) | (oldtable[j] & PTE_WRITE);
+      }
+    }
+  }
+
+  return 0;
+}
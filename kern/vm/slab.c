@@ -0,0 +1,320 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <slab.h>
+
+/*
+ * Object caches. See slab.h.
+ *
+ * A slab is one page: a struct slab header, then the objects. Each
+ * object is followed by the link that chains it on the free list of
+ * its slab, so that a free object keeps whatever its constructor put
+ * in it. The slab of an object is found by rounding its address down
+ * to the page.
+ *
+ * The slabs of a cache are on one of three lists: partial (some
+ * objects free), full and empty. Objects are always taken from a
+ * partial slab if there is one, so that empty slabs stay empty and
+ * can be given back.
+ */
+
+/* Keep this many empty slabs per cache instead of freeing them */
+#define KC_MAXEMPTY 2
+
+/* Objects are aligned to this */
+#define KC_ALIGN 8
+#define KC_ROUNDUP(x) (((x) + KC_ALIGN - 1) & ~(size_t)(KC_ALIGN - 1))
+
+struct slab {
+  struct kmem_cache *sl_cache;
+  struct slab *sl_next;         /* on the cache list the slab is on */
+  struct slab *sl_prev;
+  void *sl_free;                /* free objects */
+  unsigned sl_inuse;            /* objects handed out */
+};
+
+#define SLAB_HEADER KC_ROUNDUP(sizeof(struct slab))
+
+struct kmem_cache {
+  const char *kc_name;
+  size_t kc_size;               /* object size */
+  size_t kc_linkoff;            /* offset of the free link in an object */
+  size_t kc_stride;             /* distance between objects */
+  unsigned kc_perslab;          /* objects in a slab */
+  void (*kc_ctor)(void *);
+  void (*kc_dtor)(void *);
+
+  struct spinlock kc_lock;
+  struct slab *kc_partial;
+  struct slab *kc_full;
+  struct slab *kc_empty;
+  unsigned kc_nempty;
+
+  /* statistics */
+  unsigned long kc_nslabs;
+  unsigned long kc_inuse;
+  unsigned long kc_allocs;
+
+  struct kmem_cache *kc_next;   /* on kc_all */
+};
+
+/* every cache, for the stats */
+static struct kmem_cache *kc_all = NULL;
+static struct spinlock kc_all_lock = SPINLOCK_INITIALIZER;
+
+#define KC_LINK(kc, obj) ((void **)((char *)(obj) + (kc)->kc_linkoff))
+
+////////////////////////////////////////////////////////////
+// slab lists
+
+static void slab_push(struct slab **list, struct slab *sl)
+{
+  sl->sl_prev = NULL;
+  sl->sl_next = *list;
+  if (*list != NULL) {
+    (*list)->sl_prev = sl;
+  }
+  *list = sl;
+}
+
+static void slab_unlink(struct slab **list, struct slab *sl)
+{
+  if (sl->sl_prev != NULL) {
+    sl->sl_prev->sl_next = sl->sl_next;
+  } else {
+    KASSERT(*list == sl);
+    *list = sl->sl_next;
+  }
+  if (sl->sl_next != NULL) {
+    sl->sl_next->sl_prev = sl->sl_prev;
+  }
+  sl->sl_next = sl->sl_prev = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// slabs
+
+/*
+ * Get a page and make it a slab of free, constructed objects. Called
+ * without kc_lock, as both the page allocator and CTOR may sleep.
+ */
+static struct slab *slab_create(struct kmem_cache *kc)
+{
+  struct slab *sl;
+  char *obj;
+  unsigned i;
+
+  sl = (struct slab *)alloc_kpages(1);
+  if (sl == NULL) {
+    return NULL;
+  }
+  KASSERT(((vaddr_t)sl & PAGE_FRAME) == (vaddr_t)sl);
+
+  sl->sl_cache = kc;
+  sl->sl_next = sl->sl_prev = NULL;
+  sl->sl_free = NULL;
+  sl->sl_inuse = 0;
+
+  /* Chain the objects backwards, so the first one is handed out first */
+  for (i = kc->kc_perslab; i-- > 0; ) {
+    obj = (char *)sl + SLAB_HEADER + i * kc->kc_stride;
+    if (kc->kc_ctor != NULL) {
+      kc->kc_ctor(obj);
+    }
+    *KC_LINK(kc, obj) = sl->sl_free;
+    sl->sl_free = obj;
+  }
+
+  return sl;
+}
+
+/*
+ * Give the page of an empty slab back. Called without kc_lock.
+ */
+static void slab_destroy(struct kmem_cache *kc, struct slab *sl)
+{
+  char *obj;
+  unsigned i;
+
+  KASSERT(sl->sl_inuse == 0);
+
+  if (kc->kc_dtor != NULL) {
+    for (i = 0; i < kc->kc_perslab; i++) {
+      obj = (char *)sl + SLAB_HEADER + i * kc->kc_stride;
+      kc->kc_dtor(obj);
+    }
+  }
+
+  free_kpages((vaddr_t)sl);
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     void (*ctor)(void *),
+                                     void (*dtor)(void *))
+{
+  struct kmem_cache *kc;
+
+  KASSERT(size > 0);
+
+  kc = kmalloc(sizeof(*kc));
+  if (kc == NULL) {
+    return NULL;
+  }
+
+  kc->kc_name = name;
+  kc->kc_size = size;
+  kc->kc_linkoff = ROUNDUP(size, sizeof(void *));
+  kc->kc_stride = KC_ROUNDUP(kc->kc_linkoff + sizeof(void *));
+  kc->kc_perslab = (PAGE_SIZE - SLAB_HEADER) / kc->kc_stride;
+  KASSERT(kc->kc_perslab > 0);
+  kc->kc_ctor = ctor;
+  kc->kc_dtor = dtor;
+
+  spinlock_init(&kc->kc_lock);
+  kc->kc_partial = kc->kc_full = kc->kc_empty = NULL;
+  kc->kc_nempty = 0;
+
+  kc->kc_nslabs = 0;
+  kc->kc_inuse = 0;
+  kc->kc_allocs = 0;
+
+  spinlock_acquire(&kc_all_lock);
+  kc->kc_next = kc_all;
+  kc_all = kc;
+  spinlock_release(&kc_all_lock);
+
+  return kc;
+}
+
+void kmem_cache_destroy(struct kmem_cache *kc)
+{
+  struct kmem_cache **p;
+  struct slab *sl;
+
+  KASSERT(kc->kc_partial == NULL);
+  KASSERT(kc->kc_full == NULL);
+
+  spinlock_acquire(&kc_all_lock);
+  for (p = &kc_all; *p != kc; p = &(*p)->kc_next) {
+    KASSERT(*p != NULL);
+  }
+  *p = kc->kc_next;
+  spinlock_release(&kc_all_lock);
+
+  while (kc->kc_empty != NULL) {
+    sl = kc->kc_empty;
+    slab_unlink(&kc->kc_empty, sl);
+    slab_destroy(kc, sl);
+  }
+
+  spinlock_cleanup(&kc->kc_lock);
+  kfree(kc);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *kc)
+{
+  struct slab *sl;
+  void *obj;
+
+  spinlock_acquire(&kc->kc_lock);
+
+  if (kc->kc_partial == NULL && kc->kc_empty != NULL) {
+    sl = kc->kc_empty;
+    slab_unlink(&kc->kc_empty, sl);
+    kc->kc_nempty--;
+    slab_push(&kc->kc_partial, sl);
+  }
+
+  if (kc->kc_partial == NULL) {
+    /* Out of objects: grow the cache by a slab */
+    spinlock_release(&kc->kc_lock);
+    sl = slab_create(kc);
+    if (sl == NULL) {
+      return NULL;
+    }
+    spinlock_acquire(&kc->kc_lock);
+    slab_push(&kc->kc_partial, sl);
+    kc->kc_nslabs++;
+  }
+
+  sl = kc->kc_partial;
+  obj = sl->sl_free;
+  KASSERT(obj != NULL);
+  sl->sl_free = *KC_LINK(kc, obj);
+  sl->sl_inuse++;
+  if (sl->sl_free == NULL) {
+    slab_unlink(&kc->kc_partial, sl);
+    slab_push(&kc->kc_full, sl);
+  }
+
+  kc->kc_inuse++;
+  kc->kc_allocs++;
+
+  spinlock_release(&kc->kc_lock);
+
+  return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+  struct slab *sl, *release = NULL;
+
+  KASSERT(obj != NULL);
+
+  sl = (struct slab *)((vaddr_t)obj & PAGE_FRAME);
+  KASSERT(sl->sl_cache == kc);
+  KASSERT(((vaddr_t)obj - (vaddr_t)sl - SLAB_HEADER) % kc->kc_stride == 0);
+
+  spinlock_acquire(&kc->kc_lock);
+
+  KASSERT(sl->sl_inuse > 0);
+  if (sl->sl_free == NULL) {
+    slab_unlink(&kc->kc_full, sl);
+    slab_push(&kc->kc_partial, sl);
+  }
+  *KC_LINK(kc, obj) = sl->sl_free;
+  sl->sl_free = obj;
+  sl->sl_inuse--;
+  kc->kc_inuse--;
+
+  if (sl->sl_inuse == 0) {
+    slab_unlink(&kc->kc_partial, sl);
+    if (kc->kc_nempty < KC_MAXEMPTY) {
+      slab_push(&kc->kc_empty, sl);
+      kc->kc_nempty++;
+    } else {
+      release = sl;
+      kc->kc_nslabs--;
+    }
+  }
+
+  spinlock_release(&kc->kc_lock);
+
+  if (release != NULL) {
+    slab_destroy(kc, release);
+  }
+}
+
+void kmem_cache_printstats(void)
+{
+  struct kmem_cache *kc;
+
+  spinlock_acquire(&kc_all_lock);
+
+  kprintf("Object caches:\n");
+  kprintf("  %-14s %6s %6s %8s %8s %6s %10s\n", "name", "size", "slab",
+    "inuse", "total", "slabs", "allocs");
+  for (kc = kc_all; kc != NULL; kc = kc->kc_next) {
+    spinlock_acquire(&kc->kc_lock);
+    kprintf("  %-14s %6u %6u %8lu %8lu %6lu %10lu\n", kc->kc_name,
+      (unsigned)kc->kc_size, kc->kc_perslab, kc->kc_inuse,
+      kc->kc_nslabs * kc->kc_perslab, kc->kc_nslabs, kc->kc_allocs);
+    spinlock_release(&kc->kc_lock);
+  }
+
+  spinlock_release(&kc_all_lock);
+}
@@ -0,0 +1,355 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <vmstats.h>
+#include <pagecache.h>
+#include <swap.h>
+
+/*
+ * Swap and page replacement. See swap.h.
+ *
+ * Evicting a page of another address space needs its as_lock, which
+ * its owner holds while handling a page fault, so the pager only
+ * tries to get it: if the owner is busy the page is skipped. The
+ * faulting thread may evict pages of its own address space, as it
+ * already holds the lock.
+ *
+ * Text pages in the page cache that nobody maps any more are dropped
+ * before anything is written to swap, and also when there is no swap.
+ */
+
+/* Give up evicting after skipping this many busy pages in a row */
+#define SWAP_MAXTRIES 64
+
+static struct vnode *swap_vnode = NULL;     /* NULL if no swap */
+static struct bitmap *swap_map;             /* slots in use */
+static unsigned swap_nslots;
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+static struct lock *pageout_lock;
+static struct cv *pageout_cv;
+static bool pageout_wanted = false;
+
+////////////////////////////////////////////////////////////
+// slots
+
+static int swap_slot_alloc(unsigned *slot)
+{
+  int result;
+
+  spinlock_acquire(&swap_lock);
+  result = bitmap_alloc(swap_map, slot);
+  spinlock_release(&swap_lock);
+
+  return result;
+}
+
+void swap_release(unsigned slot)
+{
+  spinlock_acquire(&swap_lock);
+  KASSERT(slot < swap_nslots);
+  KASSERT(bitmap_isset(swap_map, slot));
+  bitmap_unmark(swap_map, slot);
+  spinlock_release(&swap_lock);
+}
+
+/*
+ * Transfer a page between memory at KBUF and a slot.
+ */
+static int swap_io(unsigned slot, void *kbuf, enum uio_rw rw)
+{
+  struct iovec iov;
+  struct uio u;
+  int result;
+
+  KASSERT(slot < swap_nslots);
+
+  uio_kinit(&iov, &u, kbuf, PAGE_SIZE, (off_t)slot * PAGE_SIZE, rw);
+  if (rw == UIO_READ) {
+    result = VOP_READ(swap_vnode, &u);
+  } else {
+    result = VOP_WRITE(swap_vnode, &u);
+  }
+  if (result) {
+    return result;
+  }
+  if (u.uio_resid != 0) {
+    return EIO;
+  }
+
+  return 0;
+}
+
+int swap_pagein(unsigned slot, paddr_t paddr)
+{
+  int result;
+
+  result = swap_io(slot, (void *)PADDR_TO_KVADDR(paddr), UIO_READ);
+  if (result) {
+    return result;
+  }
+  swap_release(slot);
+  vmstats_inc(VMS_SWAP_IN);
+
+  return 0;
+}
+
+int swap_dup(unsigned slot, unsigned *ret)
+{
+  void *buf;
+  unsigned newslot;
+  int result;
+
+  buf = kmalloc(PAGE_SIZE);
+  if (buf == NULL) {
+    return ENOMEM;
+  }
+
+  result = swap_slot_alloc(&newslot);
+  if (result) {
+    kfree(buf);
+    return result;
+  }
+
+  result = swap_io(slot, buf, UIO_READ);
+  if (result == 0) {
+    result = swap_io(newslot, buf, UIO_WRITE);
+  }
+  kfree(buf);
+  if (result) {
+    swap_release(newslot);
+    return result;
+  }
+
+  *ret = newslot;
+  return 0;
+}
+
+////////////////////////////////////////////////////////////
+// page replacement
+
+/*
+ * Evict one user page to swap. CUR is the address space whose lock
+ * the caller holds, or NULL.
+ *
+ * Return 0 if a page was evicted, EBUSY if the page picked had to be
+ * skipped (try again), or another error code if nothing can be done.
+ */
+static int swap_evict(struct addrspace *cur)
+{
+  struct addrspace *as;
+  vaddr_t vaddr;
+  paddr_t paddr;
+  pte_t *pte;
+  unsigned slot;
+  int result;
+
+  if (swap_vnode == NULL) {
+    return ENOMEM;
+  }
+
+  paddr = coremap_victim(&as, &vaddr);
+  if (paddr == 0) {
+    return ENOMEM;
+  }
+
+  if (as != cur && !lock_tryacquire(as->as_lock)) {
+    /* The owner is in the middle of a fault */
+    coremap_unbusy(paddr);
+    vmstats_inc(VMS_SWAP_SKIPPED);
+    return EBUSY;
+  }
+
+  pte = pt_lookup(as->as_pt, vaddr, false);
+  KASSERT(pte != NULL);
+  KASSERT((*pte & PTE_VALID) && (*pte & PTE_FRAME) == paddr);
+
+  result = swap_slot_alloc(&slot);
+  if (result) {
+    /* Swap is full */
+    result = ENOSPC;
+    goto out;
+  }
+
+  /*
+   * Unmap the page, then drop any translation of it: from now on an
+   * access to it faults and waits for as_lock.
+   */
+  *pte &= ~PTE_VALID;
+  vm_tlb_shootdown(as, vaddr);
+
+  result = swap_io(slot, (void *)PADDR_TO_KVADDR(paddr), UIO_WRITE);
+  if (result) {
+    *pte |= PTE_VALID;
+    swap_release(slot);
+    goto out;
+  }
+
+  *pte = PTE_MKSWAP(slot) | (*pte & (PTE_WRITE | PTE_DIRTY));
+  vmstats_inc(VMS_SWAP_OUT);
+
+ out:
+  if (as != cur) {
+    lock_release(as->as_lock);
+  }
+  if (result == 0) {
+    coremap_setowner(paddr, NULL, 0);
+  }
+  coremap_unbusy(paddr);
+  if (result == 0) {
+    coremap_free(paddr);
+  }
+
+  return result;
+}
+
+/*
+ * Ask the pageout thread to refill the free frame reserve.
+ */
+static void pageout_wakeup(void)
+{
+  lock_acquire(pageout_lock);
+  pageout_wanted = true;
+  cv_signal(pageout_cv, pageout_lock);
+  lock_release(pageout_lock);
+}
+
+static void pageout_thread(void *data1, unsigned long data2)
+{
+  unsigned long free;
+  unsigned tries;
+  int result;
+
+  (void)data1;
+  (void)data2;
+
+  while (true) {
+    lock_acquire(pageout_lock);
+    while (!pageout_wanted) {
+      cv_wait(pageout_cv, pageout_lock);
+    }
+    pageout_wanted = false;
+    lock_release(pageout_lock);
+
+    /* Unmapped text pages are clean: drop those first */
+    free = coremap_freeestimate();
+    if (free < SWAP_FREEHIGH) {
+      pagecache_reclaim(SWAP_FREEHIGH - free);
+    }
+
+    tries = 0;
+    while (coremap_freeestimate() < SWAP_FREEHIGH && tries < SWAP_MAXTRIES) {
+      result = swap_evict(NULL);
+      if (result == EBUSY) {
+        tries++;
+      } else if (result) {
+        /* Nothing to evict, or no swap space left */
+        break;
+      } else {
+        tries = 0;
+      }
+    }
+  }
+}
+
+paddr_t swap_getframe(struct addrspace *as, bool zero)
+{
+  paddr_t paddr;
+  unsigned tries = 0;
+  int result;
+
+  KASSERT(lock_do_i_hold(as->as_lock));
+
+  if (zero) {
+    vmstats_inc(VMS_ZERO_FILLS);
+  }
+
+  /* Zeroed frames are best taken from the pool idle cpus fill */
+  paddr = zero ? coremap_alloc_zeroed() : coremap_alloc(1);
+  if (paddr != 0) {
+    zero = false;
+  }
+
+  if (paddr == 0 && pagecache_reclaim(1) > 0) {
+    paddr = coremap_alloc(1);
+  }
+  while (paddr == 0 && tries < SWAP_MAXTRIES) {
+    /* The reserve ran out: evict a page ourselves */
+    result = swap_evict(as);
+    if (result == EBUSY) {
+      tries++;
+    } else if (result) {
+      break;
+    } else {
+      vmstats_inc(VMS_SWAP_DIRECT);
+    }
+    paddr = coremap_alloc(1);
+  }
+
+  if (swap_vnode != NULL && coremap_freeestimate() < SWAP_FREELOW) {
+    pageout_wakeup();
+  }
+
+  if (paddr == 0) {
+    vmstats_inc(VMS_FRAME_FAILS);
+    return 0;
+  }
+  vmstats_inc(VMS_FRAME_ALLOCS);
+
+  if (zero) {
+    /* Got it the hard way */
+    bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+  }
+
+  return paddr;
+}
+
+////////////////////////////////////////////////////////////
+// setup
+
+void swap_bootstrap(void)
+{
+  struct stat st;
+  int result;
+
+  result = vfs_swapon(SWAP_DEVICE, &swap_vnode);
+  if (result) {
+    kprintf("swap: %s: %s; running without swap\n", SWAP_DEVICE,
+      strerror(result));
+    swap_vnode = NULL;
+    return;
+  }
+
+  result = VOP_STAT(swap_vnode, &st);
+  if (result) {
+    panic("swap: cannot stat %s: %s\n", SWAP_DEVICE, strerror(result));
+  }
+  swap_nslots = st.st_size / PAGE_SIZE;
+
+  swap_map = bitmap_create(swap_nslots);
+  pageout_lock = lock_create("pageout");
+  pageout_cv = cv_create("pageout");
+  if (swap_map == NULL || pageout_lock == NULL || pageout_cv == NULL) {
+    panic("swap: out of memory\n");
+  }
+
+  result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+  if (result) {
+    panic("swap: cannot start the pageout thread: %s\n", strerror(result));
+  }
+
+  kprintf("swap: %u slots (%uk)\n", swap_nslots,
+    swap_nslots * (PAGE_SIZE / 1024));
+}
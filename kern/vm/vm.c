@@ -0,0 +1,650 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <proc.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <pagecache.h>
+#include <vmstats.h>
+#include <swap.h>
+#include <kvmap.h>
+#include <synch.h>
+#include <platform/maxcpus.h>
+
+/*
+ * Demand paging VM system (used when dumbvm is not configured).
+ *
+ * Physical memory is managed by the coremap. User pages are only
+ * backed by a frame when they are first touched: vm_fault() finds the
+ * region the faulting address belongs to, gets (and, the first time,
+ * allocates and zeroes) the frame, records it in the page table of
+ * the address space and loads the translation in the TLB. Later
+ * misses on the page are refilled from the page table.
+ *
+ * After fork, pages are shared copy-on-write between parent and child
+ * (the frame reference count is > 1). Such pages are only mapped
+ * read-only; the first write to one of them traps and gets a private
+ * copy of the page before the translation is made writeable.
+ *
+ * When memory runs short, pages are evicted to swap (see swap.c) and
+ * read back on the next fault. Page table entries of an address space
+ * only change under its as_lock, except for the lockless TLB refill
+ * fast path, which only reads them.
+ */
+
+/*
+ * Wrap ram_stealmem in a spinlock.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * TLB shootdown. Only a cpu whose current ASID belongs to an address
+ * space may hold translations of it that are in use; on the other
+ * cpus the ASID of the address space is simply dropped, so the next
+ * time it runs there it gets a new one and the old translations are
+ * unreachable. The running cpus get the pages to invalidate queued
+ * with one IPI each.
+ *
+ * tlb_as[] records the address space whose ASID is loaded on each
+ * cpu, and tlb_cpu[] the cpu itself. tlb_lock[] keeps activation on
+ * a cpu and shootdowns targeting it from crossing: an ASID is only
+ * dropped while its address space isn't loaded there.
+ */
+static struct spinlock tlb_lock[MAXCPUS];
+static struct addrspace *tlb_as[MAXCPUS];
+static struct cpu *tlb_cpu[MAXCPUS];
+
+void vm_bootstrap(void)
+{
+  unsigned i;
+
+  for (i = 0; i < MAXCPUS; i++) {
+    spinlock_init(&tlb_lock[i]);
+  }
+
+  /* Hand physical memory over to the buddy allocator */
+  coremap_bootstrap();
+  pagecache_bootstrap();
+  kvmap_bootstrap();
+  /* Devices are attached by now */
+  swap_bootstrap();
+}
+
+/*
+ * Check if we're in a context that can sleep.
+ */
+static void vm_can_sleep(void)
+{
+  if (CURCPU_EXISTS()) {
+    /* must not hold spinlocks */
+    KASSERT(curcpu->c_spinlocks == 0);
+
+    /* must not be in an interrupt handler */
+    KASSERT(curthread->t_in_interrupt == 0);
+  }
+}
+
+static paddr_t getppages(unsigned long npages)
+{
+  paddr_t addr;
+
+  if (coremap_isactive()) {
+    addr = coremap_alloc(npages);
+  } else {
+    /* too early in boot: call stealmem */
+    spinlock_acquire(&stealmem_lock);
+    addr = ram_stealmem(npages);
+    spinlock_release(&stealmem_lock);
+    vmstats_inc(VMS_STEALMEM);
+  }
+
+  vmstats_inc(addr != 0 ? VMS_FRAME_ALLOCS : VMS_FRAME_FAILS);
+  return addr;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t alloc_kpages(unsigned npages)
+{
+  paddr_t pa;
+
+  vm_can_sleep();
+  pa = getppages(npages);
+  if (pa == 0) {
+    return 0;
+  }
+  return PADDR_TO_KVADDR(pa);
+}
+
+/*
+ * Physically contiguous frames are cheaper to use, as kseg0 maps
+ * them without the TLB, so those are tried first.
+ */
+vaddr_t alloc_kvpages(unsigned npages)
+{
+  vaddr_t va;
+
+  va = alloc_kpages(npages);
+  if (va == 0 && npages > 1) {
+    va = kvmap_alloc(npages);
+  }
+  return va;
+}
+
+void free_kpages(vaddr_t addr)
+{
+  if (addr >= KVMAP_BASE) {
+    kvmap_free(addr);
+    return;
+  }
+  /* Frames stolen before vm_bootstrap are ignored by the coremap */
+  coremap_free(addr - MIPS_KSEG0);
+}
+
+/*
+ * TLB replacement: when a translation doesn't fit in a free slot, a
+ * per-cpu clock hand picks the victim, sweeping the TLB round-robin.
+ * The MIPS TLB keeps no reference bits, so this is a plain FIFO, but
+ * unlike tlb_random it never throws out the entries loaded last. The
+ * hand goes back to slot 0 on a flush, so until the TLB fills up the
+ * sweep only lands on free slots.
+ */
+static unsigned tlb_hand[MAXCPUS];
+
+/*
+ * Address space IDs. Every user translation in the TLB is tagged with
+ * the ASID of its address space, so switching address spaces only
+ * means loading another ASID: the translations of the others stay in
+ * the TLB, ready for when they run again.
+ *
+ * Each cpu hands out its own ASIDs, so no cross-cpu coordination is
+ * needed. asid_last[] counts up with the ASID in the low bits and a
+ * generation number in the high bits, and an address space records
+ * the full value it got on each cpu (as_asid[], 0 if none). The ASID
+ * is still good as long as its generation is the current one. When
+ * the ASIDs run out, a new generation starts: that is the only time
+ * the TLB is flushed, and address spaces then get new ASIDs the next
+ * time they run.
+ *
+ * ASID 0 is not handed out: it tags the invalid entries.
+ */
+#define ASID_MASK (NUM_ASID - 1)
+
+static uint32_t asid_last[MAXCPUS];
+/* ASID currently loaded on each cpu */
+static uint32_t tlb_pid[MAXCPUS];
+
+/*
+ * Invalidate every TLB entry on the current cpu.
+ * Must be called with interrupts off.
+ */
+static void tlb_flush(void)
+{
+  int i;
+
+  for (i = 0; i < NUM_TLB; i++) {
+    tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+  }
+  tlb_hand[curcpu->c_number] = 0;
+
+  /* tlb_write clobbered the current ASID */
+  tlb_setpid(tlb_pid[curcpu->c_number]);
+
+  vmstats_inc(VMS_TLB_FLUSHES);
+}
+
+/*
+ * Check if AS has a valid ASID on cpu C.
+ */
+static bool asid_valid_on(struct addrspace *as, unsigned c)
+{
+  uint32_t asid = as->as_asid[c];
+
+  return asid != 0 && ((asid ^ asid_last[c]) & ~ASID_MASK) == 0;
+}
+
+/*
+ * Check if AS has a valid ASID on the current cpu.
+ */
+static bool asid_valid(struct addrspace *as)
+{
+  return asid_valid_on(as, curcpu->c_number);
+}
+
+/*
+ * Give AS a new ASID on the current cpu, starting a new generation
+ * if needed. Must be called with interrupts off.
+ */
+static void asid_assign(struct addrspace *as)
+{
+  uint32_t asid;
+  unsigned c = curcpu->c_number;
+
+  asid = ++asid_last[c];
+  if ((asid & ASID_MASK) == 0) {
+    /* Out of ASIDs: the old generation's translations must go */
+    tlb_flush();
+    if (asid == 0) {
+      /* The counter wrapped; generation 0 would look like "none" */
+      asid = NUM_ASID;
+    }
+    /* Skip ASID 0 */
+    asid_last[c] = ++asid;
+  }
+  as->as_asid[c] = asid;
+
+  vmstats_inc(VMS_ASID_ASSIGNS);
+}
+
+void vm_tlb_activate(struct addrspace *as)
+{
+  unsigned c;
+  int spl;
+
+  spl = splhigh();
+  c = curcpu->c_number;
+
+  spinlock_acquire(&tlb_lock[c]);
+  tlb_as[c] = as;
+  tlb_cpu[c] = curcpu->c_self;
+  if (!asid_valid(as)) {
+    asid_assign(as);
+  }
+  tlb_pid[c] = as->as_asid[c] & ASID_MASK;
+  tlb_setpid(tlb_pid[c]);
+  spinlock_release(&tlb_lock[c]);
+
+  splx(spl);
+}
+
+/*
+ * Dropping the ASIDs of AS is enough to make its translations
+ * unreachable: ASIDs are not reused within a generation. Only the
+ * current cpu may be running AS, and it gets a new ASID right away.
+ */
+void vm_tlb_invalidate(struct addrspace *as)
+{
+  unsigned i;
+
+  for (i = 0; i < MAXCPUS; i++) {
+    as->as_asid[i] = 0;
+  }
+
+  if (as == proc_getas()) {
+    vm_tlb_activate(as);
+  }
+}
+
+/*
+ * Drop the ASIDs of AS on cpus other than the current one, which may
+ * still hold translations of AS that are no longer right. AS is
+ * running here, so nobody else is touching them.
+ */
+static void asid_drop_others(struct addrspace *as)
+{
+  unsigned i;
+
+  for (i = 0; i < MAXCPUS; i++) {
+    if (i != curcpu->c_number) {
+      as->as_asid[i] = 0;
+    }
+  }
+}
+
+/*
+ * Drop the translation of VADDR with ASID PID from the TLB of the
+ * current cpu, if there. Must be called with interrupts off.
+ */
+static void tlb_unload(uint32_t pid, vaddr_t vaddr)
+{
+  int i;
+
+  i = tlb_probe(vaddr | (pid << TLBHI_PIDSHIFT), 0);
+  if (i >= 0) {
+    tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+  }
+
+  /* Both clobbered the current ASID */
+  tlb_setpid(tlb_pid[curcpu->c_number]);
+}
+
+/*
+ * Handle shootdown requests from another cpu.
+ */
+void vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+  int spl;
+
+  spl = splhigh();
+  tlb_unload(ts->ts_asid, ts->ts_vaddr);
+  splx(spl);
+}
+
+void vm_tlbshootdown_all(void)
+{
+  int spl;
+
+  spl = splhigh();
+  tlb_flush();
+  splx(spl);
+}
+
+void vm_tlb_flushall(void)
+{
+  vm_can_sleep();
+
+  /* More than TLBSHOOTDOWN_MAX: a full flush */
+  ipi_tlbshootdown_allcpus(NULL, TLBSHOOTDOWN_MAX + 1);
+}
+
+void vm_tlbbatch_init(struct tlbbatch *tb, struct addrspace *as)
+{
+  tb->tb_as = as;
+  tb->tb_count = 0;
+}
+
+void vm_tlbbatch_add(struct tlbbatch *tb, vaddr_t vaddr)
+{
+  /* Past TLBSHOOTDOWN_MAX we only count: it'll be a full flush */
+  if (tb->tb_count < TLBSHOOTDOWN_MAX) {
+    tb->tb_vaddr[tb->tb_count] = vaddr;
+  }
+  tb->tb_count++;
+}
+
+/*
+ * Drop the translations of the pages in TB from the TLB of every cpu,
+ * and wait until they're gone. Their page table entries must have
+ * been changed already, so that the translations can't be loaded
+ * again.
+ */
+void vm_tlbbatch_flush(struct tlbbatch *tb)
+{
+  struct addrspace *as = tb->tb_as;
+  struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+  struct cpu *targets[MAXCPUS];
+  uint32_t seqs[MAXCPUS];
+  unsigned c, i, me, n, ntargets = 0;
+  bool overflow;
+  int spl;
+
+  if (tb->tb_count == 0) {
+    return;
+  }
+  overflow = tb->tb_count > TLBSHOOTDOWN_MAX;
+  n = overflow ? TLBSHOOTDOWN_MAX : tb->tb_count;
+
+  /* Stay on this cpu while dealing with our own TLB and the others */
+  spl = splhigh();
+  me = curcpu->c_number;
+
+  for (c = 0; c < MAXCPUS; c++) {
+    spinlock_acquire(&tlb_lock[c]);
+    if (c == me) {
+      if (overflow) {
+        /* Cheaper than flushing: move to a fresh ASID */
+        as->as_asid[c] = 0;
+        if (tlb_as[c] == as) {
+          asid_assign(as);
+          tlb_pid[c] = as->as_asid[c] & ASID_MASK;
+          tlb_setpid(tlb_pid[c]);
+        }
+      } else if (asid_valid(as)) {
+        for (i = 0; i < n; i++) {
+          tlb_unload(as->as_asid[c] & ASID_MASK, tb->tb_vaddr[i]);
+        }
+      }
+    } else if (tlb_as[c] == as && asid_valid_on(as, c)) {
+      /* Running AS: needs an IPI, sent below */
+      for (i = 0; i < n; i++) {
+        ts[i].ts_asid = as->as_asid[c] & ASID_MASK;
+        ts[i].ts_vaddr = tb->tb_vaddr[i];
+      }
+      targets[ntargets] = tlb_cpu[c];
+    } else {
+      /* Not running AS: forget its ASID */
+      as->as_asid[c] = 0;
+      spinlock_release(&tlb_lock[c]);
+      continue;
+    }
+    spinlock_release(&tlb_lock[c]);
+
+    if (c != me) {
+      seqs[ntargets] = ipi_tlbshootdown(targets[ntargets], ts,
+        tb->tb_count);
+      ntargets++;
+      vmstats_inc(VMS_TLB_IPIS);
+    }
+  }
+
+  splx(spl);
+
+  for (i = 0; i < ntargets; i++) {
+    ipi_tlbshootdown_wait(targets[i], seqs[i]);
+  }
+
+  vmstats_inc(VMS_TLB_SHOOTDOWNS);
+  tb->tb_count = 0;
+}
+
+/*
+ * Drop the translation of VADDR in AS from the TLB of every cpu, and
+ * wait until it's gone.
+ */
+void vm_tlb_shootdown(struct addrspace *as, vaddr_t vaddr)
+{
+  struct tlbbatch tb;
+
+  vm_tlbbatch_init(&tb, as);
+  vm_tlbbatch_add(&tb, vaddr);
+  vm_tlbbatch_flush(&tb);
+}
+
+/*
+ * Load a translation of AS (the current address space) in the TLB.
+ * An existing entry for the same page is overwritten, otherwise the
+ * clock hand picks the slot.
+ */
+static void tlb_load(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+  bool writeable)
+{
+  uint32_t ehi, elo, oldhi, oldlo;
+  unsigned *hand;
+  int i, spl;
+
+  /* Disable interrupts on this CPU while frobbing the TLB. */
+  spl = splhigh();
+
+  KASSERT(asid_valid(as));
+  ehi = vaddr |
+    ((as->as_asid[curcpu->c_number] & ASID_MASK) << TLBHI_PIDSHIFT);
+  elo = paddr | TLBLO_VALID | (writeable ? TLBLO_DIRTY : 0);
+
+  i = tlb_probe(ehi, 0);
+  if (i < 0) {
+    hand = &tlb_hand[curcpu->c_number];
+    i = *hand;
+    *hand = (i + 1) % NUM_TLB;
+
+    /* This clobbers the current ASID; tlb_write below restores it */
+    tlb_read(&oldhi, &oldlo, i);
+    vmstats_inc((oldlo & TLBLO_VALID) ? VMS_TLB_EVICTS : VMS_TLB_FREE);
+  }
+
+  DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", vaddr, paddr);
+  tlb_write(ehi, elo, i);
+
+  splx(spl);
+
+  /* For the pager's clock */
+  coremap_touch(paddr);
+}
+
+/*
+ * Load the translation of a kernel page in kseg2, as a global entry
+ * so that it holds in every address space. The current ASID goes in
+ * EntryHi anyway, as tlb_write loads it from there.
+ */
+static int vm_kfault(vaddr_t vaddr)
+{
+  uint32_t ehi, elo, oldhi, oldlo;
+  paddr_t paddr;
+  unsigned *hand;
+  int i, spl;
+
+  paddr = kvmap_translate(vaddr);
+  if (paddr == 0) {
+    return EFAULT;
+  }
+  vmstats_inc(VMS_KVMAP_FAULTS);
+
+  spl = splhigh();
+
+  ehi = vaddr | (tlb_pid[curcpu->c_number] << TLBHI_PIDSHIFT);
+  elo = paddr | TLBLO_VALID | TLBLO_DIRTY | TLBLO_GLOBAL;
+
+  i = tlb_probe(ehi, 0);
+  if (i < 0) {
+    hand = &tlb_hand[curcpu->c_number];
+    i = *hand;
+    *hand = (i + 1) % NUM_TLB;
+
+    tlb_read(&oldhi, &oldlo, i);
+    vmstats_inc((oldlo & TLBLO_VALID) ? VMS_TLB_EVICTS : VMS_TLB_FREE);
+  }
+
+  DEBUG(DB_VM, "vm: kernel 0x%x -> 0x%x\n", vaddr, paddr);
+  tlb_write(ehi, elo, i);
+
+  splx(spl);
+  return 0;
+}
+
+int vm_fault(int faulttype, vaddr_t faultaddress)
+{
+  struct addrspace *as;
+  struct region *rg;
+  pte_t *ptep, oldpte, pte;
+  bool writeable;
+  int result, spl;
+
+  faultaddress &= PAGE_FRAME;
+
+  DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+  switch (faulttype) {
+    case VM_FAULT_READONLY:
+      vmstats_inc(VMS_TLB_READONLY);
+      break;
+    case VM_FAULT_READ:
+    case VM_FAULT_WRITE:
+      vmstats_inc(VMS_TLB_FAULTS);
+      break;
+    default:
+      return EINVAL;
+  }
+
+  if (faultaddress >= MIPS_KSEG2) {
+    /* Kernel pages are always writeable, so never VM_FAULT_READONLY */
+    return faulttype == VM_FAULT_READONLY ? EFAULT :
+      vm_kfault(faultaddress);
+  }
+
+  if (curproc == NULL) {
+    /*
+     * No process. This is probably a kernel fault early
+     * in boot. Return EFAULT so as to panic instead of
+     * getting into an infinite faulting loop.
+     */
+    return EFAULT;
+  }
+
+  as = proc_getas();
+  if (as == NULL) {
+    /*
+     * No address space set up. This is probably also a
+     * kernel fault early in boot.
+     */
+    return EFAULT;
+  }
+
+  /*
+   * Fast path: a TLB miss on a resident page that doesn't need any
+   * work before this kind of access is refilled straight from the
+   * page table, without looking for the region or taking as_lock.
+   * Interrupts stay off from reading the entry to loading it, so a
+   * shootdown for a page being evicted can't slip in between.
+   */
+  spl = splhigh();
+  ptep = pt_lookup(as->as_pt, faultaddress, false);
+  pte = ptep != NULL ? *ptep : 0;
+  if (faulttype != VM_FAULT_READONLY && (pte & PTE_VALID)) {
+    writeable = (pte & (PTE_WRITE | PTE_COW)) == PTE_WRITE;
+    /* (a copy-on-write page no longer shared is taken back below) */
+    if ((faulttype == VM_FAULT_READ && (!(pte & PTE_COW) ||
+         coremap_refcount(pte & PTE_FRAME) > 1)) || writeable) {
+      vmstats_inc(VMS_TLB_REFILLS);
+      tlb_load(as, faultaddress, pte & PTE_FRAME, writeable);
+      splx(spl);
+      return 0;
+    }
+  }
+  splx(spl);
+
+  lock_acquire(as->as_lock);
+
+  rg = as_find_region(as, faultaddress);
+  if (rg == NULL) {
+    /* Below the stack: grow it if there's room */
+    rg = as_grow_stack(as, faultaddress);
+  }
+  if (rg == NULL) {
+    result = EFAULT;
+    goto out;
+  }
+
+  writeable = as_region_writeable(as, rg);
+  if (faulttype != VM_FAULT_READ && !writeable) {
+    /* Write attempted on a page of a read-only region */
+    result = EFAULT;
+    goto out;
+  }
+
+  ptep = pt_lookup(as->as_pt, faultaddress, false);
+  oldpte = ptep != NULL ? *ptep : 0;
+
+  /*
+   * First touch allocates and zero-fills the page, a page in swap is
+   * read back, and a write breaks copy-on-write sharing.
+   */
+  result = as_fault_page(as, rg, faultaddress,
+    faulttype != VM_FAULT_READ, &pte);
+  if (result) {
+    goto out;
+  }
+
+  /*
+   * Keep shared pages read-only until they are written, and pages
+   * of shared file mappings until they are marked dirty.
+   */
+  if ((pte & PTE_COW) || ((rg->rg_flags & RG_SHARED) && !(pte & PTE_WRITE))) {
+    writeable = false;
+  }
+
+  /* Other cpus may still map the frame the page had before */
+  if ((oldpte & PTE_VALID) && (oldpte & PTE_FRAME) != (pte & PTE_FRAME)) {
+    asid_drop_others(as);
+  }
+
+  tlb_load(as, faultaddress, pte & PTE_FRAME, writeable);
+
+ out:
+  lock_release(as->as_lock);
+  return result;
+}
@@ -0,0 +1,65 @@
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <vmstats.h>
+#include <platform/maxcpus.h>
+
+/*
+ * VM event counters. See vmstats.h.
+ */
+
+static const char *vms_names[VMS_NSTATS] = VMS_NAMES;
+
+static unsigned long vms_counts[MAXCPUS][VMS_NSTATS];
+
+void vmstats_inc(unsigned stat)
+{
+  int spl;
+
+  KASSERT(stat < VMS_NSTATS);
+
+  /* Stay on this cpu while touching its slot */
+  spl = splhigh();
+  if (CURCPU_EXISTS()) {
+    vms_counts[curcpu->c_number][stat]++;
+  } else {
+    vms_counts[0][stat]++;
+  }
+  splx(spl);
+}
+
+/*
+ * The sums are read without stopping the other cpus, so they may be
+ * off by the events counted meanwhile.
+ */
+unsigned vmstats_get(unsigned long *counts, unsigned n)
+{
+  unsigned i, j;
+
+  if (n > VMS_NSTATS) {
+    n = VMS_NSTATS;
+  }
+  for (i = 0; i < n; i++) {
+    counts[i] = 0;
+    for (j = 0; j < MAXCPUS; j++) {
+      counts[i] += vms_counts[j][i];
+    }
+  }
+
+  return n;
+}
+
+void vmstats_print(void)
+{
+  unsigned long counts[VMS_NSTATS];
+  unsigned i;
+
+  vmstats_get(counts, VMS_NSTATS);
+
+  kprintf("VM statistics:\n");
+  for (i = 0; i < VMS_NSTATS; i++) {
+    kprintf("  %-30s %10lu\n", vms_names[i], counts[i]);
+  }
+}
@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <err.h>
+#include <sys/vmstat.h>
+
+/*
+ * vmstat - print the kernel's VM event counters.
+ *
+ * Usage: vmstat
+ */
+
+static const char *names[VMS_NSTATS] = VMS_NAMES;
+
+int
+main(void)
+{
+	unsigned long counts[VMS_NSTATS];
+	int i, n;
+
+	n = vmstat(counts, VMS_NSTATS);
+	if (n < 0) {
+		err(1, "vmstat");
+	}
+
+	for (i = 0; i < n; i++) {
+		printf("%-30s %10lu\n", names[i], counts[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the PROT_, MAP_ and MS_ #defines from the kernel
+ */
+#include <kern/mman.h>
+
+/*
+ * mmap maps LEN bytes of the file open on FD, from OFFSET (which must
+ * be page-aligned), or zero-filled memory if MAP_ANON is given (FD is
+ * then ignored). ADDR is only a hint and is currently ignored.
+ *
+ * munmap must be given a whole mapping. msync writes modified pages
+ * of shared file mappings back to the file; this also happens on
+ * munmap and when the process exits.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+
+#endif /* _SYS_MMAN_H_ */
@@ -0,0 +1,15 @@
+#ifndef _SYS_VMSTAT_H_
+#define _SYS_VMSTAT_H_
+
+/*
+ * Get the VMS_ #defines from the kernel
+ */
+#include <kern/vmstat.h>
+
+/*
+ * vmstat stores up to N of the kernel's VM event counters, indexed by
+ * the VMS_ values, in COUNTS, and returns how many it stored.
+ */
+int vmstat(unsigned long *counts, int n);
+
+#endif /* _SYS_VMSTAT_H_ */